@@ -0,0 +1,276 @@
+/**
+ * @file
+ * Per-thread hardware performance counters (perf_event_open)
+ */
+
+#include "perf_counters.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+typedef struct {
+    char name[32];
+    unsigned int type;
+    unsigned long long config;
+} perf_event_desc_t;
+
+static perf_event_desc_t events[PERF_MAX_EVENTS];
+static int nevents = 0;
+
+static const struct {
+    const char *name;
+    unsigned int type;
+    unsigned long long config;
+} named_events[] = {
+    { "cycles",           PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "llc-misses",       PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "llc-refs",         PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+    { "branch-misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    { "cpu-migrations",   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS },
+    { NULL, 0, 0 }
+};
+
+static int add_event(const char *name, int len)
+{
+    perf_event_desc_t *e;
+    char *end;
+    int i;
+
+    if ( nevents == PERF_MAX_EVENTS || len <= 0 || len >= (int)sizeof(e->name) )
+        return -1;
+
+    e = &events[nevents];
+    memcpy(e->name, name, len);
+    e->name[len] = '\0';
+
+    for ( i = 0; named_events[i].name; i++ ) {
+        if ( !strcmp(e->name, named_events[i].name) ) {
+            e->type = named_events[i].type;
+            e->config = named_events[i].config;
+            nevents++;
+            return 0;
+        }
+    }
+
+    // raw event, e.g. r01d2 (umask 0x01, event 0xd2)
+    if ( e->name[0] == 'r' && e->name[1] ) {
+        e->type = PERF_TYPE_RAW;
+        e->config = strtoull(e->name + 1, &end, 16);
+        if ( *end == '\0' ) {
+            nevents++;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Selects the events that perf_counters_open() will count
+ * @param list "default" (cycles, instructions and LLC misses) or
+ *        a comma-separated list of event names
+ * @return 0 if successful, -1 on unknown events or too many events
+ */
+int perf_events_parse(const char *list)
+{
+    const char *s = list, *comma;
+
+    nevents = 0;
+    if ( !strcmp(list, "default") )
+        s = "cycles,instructions,llc-misses";
+
+    while ( *s ) {
+        comma = strchr(s, ',');
+        if ( !comma )
+            comma = s + strlen(s);
+        if ( add_event(s, comma - s) ) {
+            nevents = 0;
+            return -1;
+        }
+        s = *comma ? comma + 1 : comma;
+    }
+
+    return nevents ? 0 : -1;
+}
+
+/**
+ * @return number of selected events (0 if counters are not used)
+ */
+int perf_events_count(void)
+{
+    return nevents;
+}
+
+static int open_event(perf_event_desc_t *e, int group_fd)
+{
+    struct perf_event_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = e->type;
+    attr.config = e->config;
+    attr.disabled = group_fd == -1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // calling thread only, on any cpu; count kernel time too (e.g.
+    // futex calls) if we are allowed to
+    fd = syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+    if ( fd < 0 && (errno == EACCES || errno == EPERM) ) {
+        attr.exclude_kernel = 1;
+        fd = syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+    }
+
+    return fd;
+}
+
+/**
+ * Tries every selected event in the calling thread, and warns about
+ * those that cannot be counted (they will be reported as n/a)
+ * @param out output stream for the warnings
+ * @return number of events that can be counted
+ */
+int perf_events_check(FILE *out)
+{
+    int i, fd, ok = 0;
+
+    for ( i = 0; i < nevents; i++ ) {
+        fd = open_event(&events[i], -1);
+        if ( fd < 0 ) {
+            fprintf(out, "Warning: cannot count %s (%s)\n",
+                         events[i].name, strerror(errno));
+            continue;
+        }
+        close(fd);
+        ok++;
+    }
+
+    return ok;
+}
+
+/**
+ * Opens the counter group of the calling thread; counters start
+ * disabled
+ * @param pc counters of the calling thread
+ * @return number of events that could be opened
+ */
+int perf_counters_open(perf_counters_t *pc)
+{
+    int i, opened = 0;
+
+    perf_counters_clear(pc);
+    for ( i = 0; i < nevents; i++ ) {
+        pc->fd[i] = open_event(&events[i], pc->leader);
+        if ( pc->fd[i] < 0 ) {
+            pc->valid[i] = 0;
+            continue;
+        }
+        if ( pc->leader == -1 )
+            pc->leader = pc->fd[i];
+        opened++;
+    }
+
+    return opened;
+}
+
+void perf_counters_start(perf_counters_t *pc)
+{
+    if ( pc->leader == -1 )
+        return;
+
+    ioctl(pc->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(pc->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/**
+ * Stops the counters and adds their counts since the last start,
+ * scaled up if the group was multiplexed with other events
+ * @param pc counters of the calling thread
+ */
+void perf_counters_stop(perf_counters_t *pc)
+{
+    unsigned long long val[3];
+    int i;
+
+    if ( pc->leader == -1 )
+        return;
+
+    ioctl(pc->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    for ( i = 0; i < nevents; i++ ) {
+        if ( pc->fd[i] < 0 )
+            continue;
+        // value, time enabled, time running
+        if ( read(pc->fd[i], val, sizeof(val)) != sizeof(val) || val[2] == 0 ) {
+            pc->valid[i] = 0;
+            continue;
+        }
+        pc->count[i] += val[0] * ((double)val[1] / val[2]);
+    }
+}
+
+void perf_counters_close(perf_counters_t *pc)
+{
+    int i;
+
+    for ( i = 0; i < nevents; i++ ) {
+        if ( pc->fd[i] >= 0 )
+            close(pc->fd[i]);
+        pc->fd[i] = -1;
+    }
+    pc->leader = -1;
+}
+
+/**
+ * Resets counts; all events start out valid, so that merging into
+ * a cleared set keeps only events counted by every thread
+ * @param pc counters
+ */
+void perf_counters_clear(perf_counters_t *pc)
+{
+    int i;
+
+    pc->leader = -1;
+    for ( i = 0; i < PERF_MAX_EVENTS; i++ ) {
+        pc->fd[i] = -1;
+        pc->count[i] = 0;
+        pc->valid[i] = 1;
+    }
+}
+
+void perf_counters_merge(perf_counters_t *dst, perf_counters_t *src)
+{
+    int i;
+
+    for ( i = 0; i < nevents; i++ ) {
+        dst->count[i] += src->count[i];
+        dst->valid[i] &= src->valid[i];
+    }
+}
+
+/**
+ * Prints every event as <name>_per_op:<count / ops>, or n/a if it
+ * was not counted
+ * @param out output stream
+ * @param pc (merged) counters
+ * @param ops operations to normalize to
+ */
+void perf_counters_report(FILE *out, perf_counters_t *pc, double ops)
+{
+    int i;
+
+    for ( i = 0; i < nevents; i++ ) {
+        if ( pc->valid[i] && ops > 0 )
+            fprintf(out, " \t%s_per_op:%lf", events[i].name, pc->count[i] / ops);
+        else
+            fprintf(out, " \t%s_per_op:n/a", events[i].name);
+    }
+}
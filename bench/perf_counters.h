@@ -0,0 +1,45 @@
+/**
+ * @file
+ * Per-thread hardware performance counters (perf_event_open)
+ *
+ * The events to count are chosen once per program with
+ * perf_events_parse(). Every thread then opens its own counter
+ * group, counting only itself on whatever cpu it runs, and
+ * starts / stops it around its timed region. Events that cannot
+ * be opened (no PMU access, unknown raw event, counters taken by
+ * someone else) are reported as n/a instead of failing the run.
+ */
+#ifndef BENCH_PERF_COUNTERS_H_
+#define BENCH_PERF_COUNTERS_H_
+
+#include <stdio.h>
+
+#define PERF_MAX_EVENTS 8
+
+#define PERF_EVENTS_USAGE "default | comma-separated list of cycles, instructions, " \
+                          "llc-misses, llc-refs, branch-misses, context-switches, " \
+                          "cpu-migrations, r<hex raw event>"
+
+typedef struct {
+    //! counter file descriptors, -1 for events that could not be opened
+    int fd[PERF_MAX_EVENTS];
+    //! group leader (first event opened), -1 if none
+    int leader;
+    //! counts accumulated over start/stop pairs, scaled for multiplexing
+    double count[PERF_MAX_EVENTS];
+    //! whether the event was actually counted
+    int valid[PERF_MAX_EVENTS];
+} perf_counters_t;
+
+extern int perf_events_parse(const char *list);
+extern int perf_events_count(void);
+extern int perf_events_check(FILE *out);
+extern int perf_counters_open(perf_counters_t *pc);
+extern void perf_counters_start(perf_counters_t *pc);
+extern void perf_counters_stop(perf_counters_t *pc);
+extern void perf_counters_close(perf_counters_t *pc);
+extern void perf_counters_clear(perf_counters_t *pc);
+extern void perf_counters_merge(perf_counters_t *dst, perf_counters_t *src);
+extern void perf_counters_report(FILE *out, perf_counters_t *pc, double ops);
+
+#endif
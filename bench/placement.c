@@ -0,0 +1,152 @@
+/**
+ * @file
+ * Thread placement policies shared by the performance tests
+ */
+
+#include "placement.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void add_slot(placement_t *pl, procmap_t *pi, int p, int c, int t)
+{
+    place_slot_t *s = &pl->slots[pl->nslots++];
+
+    s->cpu_id = pi->package[p].core[c].thread[t]->cpu_id;
+    s->package = p;
+    s->core = c;
+    s->thread = t;
+}
+
+/**
+ * Looks up the package, core and hw thread of a cpu
+ * @return 0 if found, -1 otherwise
+ */
+static int add_cpu(placement_t *pl, procmap_t *pi, int cpu_id)
+{
+    int p, c, t;
+
+    for ( p = 0; p < pi->num_packages; p++ )
+        for ( c = 0; c < pi->num_cores_per_package; c++ )
+            for ( t = 0; t < pi->num_threads_per_core; t++ )
+                if ( pi->package[p].core[c].thread[t]->cpu_id == cpu_id ) {
+                    add_slot(pl, pi, p, c, t);
+                    return 0;
+                }
+
+    return -1;
+}
+
+/**
+ * Parses a comma-separated list of cpus and cpu ranges ("0,2,8-11")
+ * @return 0 if successful, -1 on malformed lists or unknown cpus
+ */
+static int parse_list(placement_t *pl, procmap_t *pi, const char *spec)
+{
+    const char *s = spec;
+    char *end;
+    long first, last, cpu;
+
+    while ( *s ) {
+        first = last = strtol(s, &end, 10);
+        if ( end == s || first < 0 )
+            return -1;
+        s = end;
+        if ( *s == '-' ) {
+            s++;
+            last = strtol(s, &end, 10);
+            if ( end == s || last < first )
+                return -1;
+            s = end;
+        }
+        for ( cpu = first; cpu <= last; cpu++ ) {
+            if ( pl->nslots == pi->num_cpus || add_cpu(pl, pi, (int)cpu) ) {
+                fprintf(stderr, "Cpu %ld not available\n", cpu);
+                return -1;
+            }
+        }
+        if ( *s == ',' )
+            s++;
+        else if ( *s )
+            return -1;
+    }
+
+    return pl->nslots ? 0 : -1;
+}
+
+/**
+ * Builds the cpu order of a placement policy
+ * @param pi processor map
+ * @param spec policy name or explicit cpu list
+ * @return the placement, or NULL if _spec_ is not valid
+ */
+placement_t* placement_init(procmap_t *pi, const char *spec)
+{
+    placement_t *pl;
+    int p, c, t;
+
+    pl = (placement_t*)malloc(sizeof(placement_t));
+    if ( pl )
+        pl->slots = (place_slot_t*)malloc(pi->num_cpus * sizeof(place_slot_t));
+    if ( !pl || !pl->slots ) {
+        fprintf(stderr, "%s: Allocation error\n", __FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    pl->nslots = 0;
+
+    if ( !strcmp(spec, "compact") ) {
+        pl->name = "compact";
+        for ( t = 0; t < pi->num_threads_per_core; t++ )
+            for ( p = 0; p < pi->num_packages; p++ )
+                for ( c = 0; c < pi->num_cores_per_package; c++ )
+                    add_slot(pl, pi, p, c, t);
+    } else if ( !strcmp(spec, "scatter") ) {
+        pl->name = "scatter";
+        for ( t = 0; t < pi->num_threads_per_core; t++ )
+            for ( c = 0; c < pi->num_cores_per_package; c++ )
+                for ( p = 0; p < pi->num_packages; p++ )
+                    add_slot(pl, pi, p, c, t);
+    } else if ( !strcmp(spec, "smt-first") ) {
+        pl->name = "smt-first";
+        for ( p = 0; p < pi->num_packages; p++ )
+            for ( c = 0; c < pi->num_cores_per_package; c++ )
+                for ( t = 0; t < pi->num_threads_per_core; t++ )
+                    add_slot(pl, pi, p, c, t);
+    } else {
+        pl->name = "list";
+        if ( parse_list(pl, pi, spec) ) {
+            placement_destroy(pl);
+            return NULL;
+        }
+    }
+
+    return pl;
+}
+
+/**
+ * Prints the cpu of every thread slot
+ * @param pl placement
+ * @param out output stream
+ */
+void placement_print(placement_t *pl, FILE *out)
+{
+    int i;
+
+    fprintf(out, "Thread mapping (%s):\n", pl->name);
+    for ( i = 0; i < pl->nslots; i++ )
+        fprintf(out, "Thread %d @ package %d, core %d, "
+                     "hw thread %d (cpuid: %d)\n",
+                     i, pl->slots[i].package, pl->slots[i].core,
+                     pl->slots[i].thread, pl->slots[i].cpu_id);
+    fprintf(out, "\n");
+}
+
+/**
+ * Frees a placement
+ * @param pl placement
+ */
+void placement_destroy(placement_t *pl)
+{
+    free(pl->slots);
+    free(pl);
+}
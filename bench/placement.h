@@ -0,0 +1,42 @@
+/**
+ * @file
+ * Thread placement policies shared by the performance tests
+ *
+ * A placement is an ordered list of cpus; the i-th thread of a test
+ * runs on the (i mod nslots)-th entry. Policies:
+ *  - compact:   fill the cores of a package, then the next package,
+ *               and only then SMT siblings
+ *  - scatter:   round-robin over packages, one thread per core, and
+ *               SMT siblings last
+ *  - smt-first: fill all hw threads of a core before the next core,
+ *               and all cores of a package before the next package
+ *  - explicit cpu list, e.g. "0,2,8-11"
+ */
+#ifndef BENCH_PLACEMENT_H_
+#define BENCH_PLACEMENT_H_
+
+#include <stdio.h>
+
+#include "util/processor_map.h"
+
+typedef struct {
+    int cpu_id;
+    int package;
+    int core;
+    int thread;
+} place_slot_t;
+
+typedef struct {
+    //! policy name, or "list" for explicit cpu lists
+    const char *name;
+    int nslots;
+    place_slot_t *slots;
+} placement_t;
+
+#define PLACEMENT_USAGE "compact | scatter | smt-first | cpu list (e.g. 0,2,8-11)"
+
+extern placement_t* placement_init(procmap_t *pi, const char *spec);
+extern void placement_print(placement_t *pl, FILE *out);
+extern void placement_destroy(placement_t *pl);
+
+#endif
@@ -0,0 +1,66 @@
+/**
+ * @file
+ * Summary statistics over repeated benchmark runs
+ */
+#ifndef BENCH_STATS_H_
+#define BENCH_STATS_H_
+
+#include <math.h>
+
+typedef struct {
+    //! number of samples
+    int n;
+    double mean;
+    //! sample standard deviation
+    double stddev;
+    //! half-width of the 95% confidence interval of the mean
+    double ci95;
+} stats_t;
+
+/**
+ * Two-sided 95% quantile of Student's t distribution
+ * @param df degrees of freedom
+ */ 
+static inline double student_t95(int df)
+{
+    static const double t[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+         2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+         2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+
+    if ( df <= 30 ) return t[df - 1];
+    if ( df <= 40 ) return 2.021;
+    if ( df <= 60 ) return 2.000;
+    if ( df <= 120 ) return 1.980;
+    return 1.960;
+}
+
+/**
+ * Computes mean, standard deviation and 95% confidence interval
+ * @param st placeholder for the results
+ * @param x samples
+ * @param n number of samples
+ */ 
+static inline void stats_compute(stats_t *st, const double *x, int n)
+{
+    double sum = 0, sq = 0;
+    int i;
+
+    st->n = n;
+    st->mean = st->stddev = st->ci95 = 0;
+    if ( n == 0 )
+        return;
+
+    for ( i = 0; i < n; i++ )
+        sum += x[i];
+    st->mean = sum / n;
+    if ( n == 1 )
+        return;
+
+    for ( i = 0; i < n; i++ )
+        sq += (x[i] - st->mean) * (x[i] - st->mean);
+    st->stddev = sqrt(sq / (n - 1));
+    st->ci95 = student_t95(n - 1) * st->stddev / sqrt(n);
+}
+
+#endif
@@ -0,0 +1,359 @@
+/**
+ * @file
+ * Tests scalability of various barrier implementations
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "synch.h"
+#include "bench/stats.h"
+#include "bench/placement.h"
+#include "util/tsc_x86_64.h"
+#include "util/processor_map.h"
+#include "util/util.h"
+
+// barrier episodes per thread
+unsigned long iters;
+// per-episode load imbalance: every thread works for a random
+// number of cycles in [0, imbalance_cycles] before each episode
+unsigned long imbalance_cycles = 0;
+
+// measured runs per configuration, and discarded warm-up runs before them
+int reps = 1;
+int warmups = 0;
+pthread_barrier_t bar;
+tsctimer_t tim;
+
+spin_barrier_t sbarrier;
+dissem_barrier_t dbarrier;
+tourn_barrier_t tbarrier;
+ctree_barrier_t cbarrier;
+futex_barrier_t fbarrier;
+hier_barrier_t hbarrier;
+pthread_barrier_t pbarrier;
+
+typedef enum {
+    NO_OP = 0,
+    SPIN_BARRIER,
+    SPIN_BARRIER_LSENSE,
+    DISSEM_BARRIER,
+    TOURN_BARRIER,
+    CTREE_BARRIER,
+    HIER_BARRIER,
+    FUTEX_BARRIER,
+    PTHREAD_BARRIER
+} opcode_t;
+
+typedef struct {
+    opcode_t code;
+    char *name;
+    //! waiters sleep: also run with more threads than cpus
+    int blocking;
+} op_desc_t;
+
+#define INIT_OP(o) {.code = o, .name = #o}
+#define INIT_BLOCKING_OP(o) {.code = o, .name = #o, .blocking = 1}
+
+op_desc_t ops[] = {
+    // resets the release flag on the first arrival, so a fast thread
+    // of the next episode can lock out the slow ones of this episode
+    /*INIT_OP(SPIN_BARRIER),*/
+    INIT_OP(SPIN_BARRIER_LSENSE),
+    INIT_OP(DISSEM_BARRIER),
+    INIT_OP(TOURN_BARRIER),
+    INIT_OP(CTREE_BARRIER),
+    INIT_OP(HIER_BARRIER),
+    INIT_BLOCKING_OP(FUTEX_BARRIER),
+    INIT_BLOCKING_OP(PTHREAD_BARRIER),
+    INIT_OP(NO_OP)
+};
+
+typedef struct {
+    int id;
+    op_desc_t *od;
+    unsigned int lsense;
+    barrier_local_t bl;
+    //! state of the imbalance generator
+    unsigned long seed;
+    //! cycles spent inside the barrier calls
+    unsigned long wait_cycles;
+} targs_t;
+
+static inline unsigned long next_rand(unsigned long *seed)
+{
+    // xorshift64
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    return *seed;
+}
+
+static inline unsigned long read_tsc(void)
+{
+    unsigned int lo, hi;
+
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((unsigned long)hi << 32) | lo;
+}
+
+static inline void work(targs_t *ta)
+{
+    if ( imbalance_cycles )
+        spin_for_cycles(next_rand(&ta->seed) % (imbalance_cycles + 1));
+}
+
+#define BARRIER_LOOP(wait)                                  \
+    for ( i = 0; i < iters; i++ ) {                         \
+        work(ta);                                           \
+        start = read_tsc();                                 \
+        wait;                                               \
+        ta->wait_cycles += read_tsc() - start;              \
+    }
+
+void* thread_fn(void *args)
+{
+    unsigned long i, start;
+    targs_t *ta = (targs_t*)args;
+
+    pthread_barrier_wait(&bar);
+    if ( ta->id == 0 ) timer_start(&tim);
+
+    switch ( ta->od->code ) {
+
+        case SPIN_BARRIER:
+            BARRIER_LOOP(spin_barrier(&sbarrier));
+            break;
+
+        case SPIN_BARRIER_LSENSE:
+            BARRIER_LOOP(spin_barrier_lsense(&sbarrier, &ta->lsense));
+            break;
+
+        case DISSEM_BARRIER:
+            BARRIER_LOOP(dissem_barrier(&dbarrier, &ta->bl));
+            break;
+
+        case TOURN_BARRIER:
+            BARRIER_LOOP(tourn_barrier(&tbarrier, &ta->bl));
+            break;
+
+        case CTREE_BARRIER:
+            BARRIER_LOOP(ctree_barrier(&cbarrier, &ta->bl));
+            break;
+
+        case HIER_BARRIER:
+            BARRIER_LOOP(hier_barrier(&hbarrier, &ta->bl));
+            break;
+
+        case FUTEX_BARRIER:
+            BARRIER_LOOP(futex_barrier(&fbarrier, &ta->bl));
+            break;
+
+        case PTHREAD_BARRIER:
+            BARRIER_LOOP(pthread_barrier_wait(&pbarrier));
+            break;
+
+        default:
+            break;
+    }
+
+    pthread_barrier_wait(&bar);
+    if ( ta->id == 0 ) timer_stop(&tim);
+
+    pthread_exit(NULL);
+}
+
+// per-thread state of the current thread count
+targs_t *targs;
+pthread_t *tids;
+pthread_attr_t *attr;
+
+// thread i runs on cpusets[i % ncpus], i.e. on core cores[i % ncpus]
+// of package packages[i % ncpus]
+cpu_set_t *cpusets;
+int *packages, *cores;
+int *thread_packages, *thread_cores;
+int ncpus;
+
+/*
+ * Runs _od_ once on _nthreads_ threads; results are left in targs[]
+ */
+void run_op(op_desc_t *od, int nthreads)
+{
+    int i;
+
+    timer_clear(&tim);
+    for ( i = 0; i < nthreads; i++ ) {
+        thread_packages[i] = packages[i % ncpus];
+        thread_cores[i] = cores[i % ncpus];
+    }
+
+    spin_barrier_init(&sbarrier, nthreads);
+    dissem_barrier_init(&dbarrier, nthreads);
+    tourn_barrier_init(&tbarrier, nthreads);
+    ctree_barrier_init(&cbarrier, nthreads);
+    hier_barrier_init(&hbarrier, nthreads, thread_packages, thread_cores);
+    futex_barrier_init(&fbarrier, nthreads);
+    pthread_barrier_init(&pbarrier, NULL, nthreads);
+
+    for ( i = 0; i < nthreads; i++ ) {
+        targs[i].id = i;
+        targs[i].od = od;
+        spin_barrier_init_lsense(&targs[i].lsense);
+        barrier_local_init(&targs[i].bl, i);
+        targs[i].seed = 0x9e3779b97f4a7c15UL * (i + 1);
+        targs[i].wait_cycles = 0;
+        pthread_attr_init(&attr[i]);
+        pthread_attr_setaffinity_np(&attr[i],
+                                    sizeof(cpu_set_t),
+                                    &cpusets[i % ncpus]);
+        pthread_create(&tids[i], &attr[i], thread_fn, (void*)&targs[i]);
+    }
+
+    for ( i = 0; i < nthreads; i++ ) {
+        pthread_join(tids[i], NULL);
+        pthread_attr_destroy(&attr[i]);
+    }
+
+    dissem_barrier_destroy(&dbarrier);
+    tourn_barrier_destroy(&tbarrier);
+    ctree_barrier_destroy(&cbarrier);
+    hier_barrier_destroy(&hbarrier);
+    pthread_barrier_destroy(&pbarrier);
+}
+
+int main(int argc, char **argv)
+{
+    procmap_t *pi;
+    placement_t *pl;
+    char *placement_spec = "compact";
+    int i, nthreads, maxthreads, op, opt, rep;
+    unsigned long wait_cycles;
+    double *rates;
+    stats_t rate;
+
+    while ( (opt = getopt(argc, argv, "i:R:W:P:")) != -1 ) {
+        switch ( opt ) {
+            case 'i':
+                imbalance_cycles = atol(optarg);
+                break;
+            case 'R':
+                reps = atoi(optarg);
+                break;
+            case 'W':
+                warmups = atoi(optarg);
+                break;
+            case 'P':
+                placement_spec = optarg;
+                break;
+            default:
+                argc = 0;
+        }
+    }
+
+    if ( argc - optind < 2 || reps < 1 || warmups < 0 ) {
+       printf("Usage: ./prog [-i imbalance_cycles] [-R reps] [-W warmups] "
+              "[-P placement] <maxthreads> <episodes>\n");
+       printf("       placement: " PLACEMENT_USAGE " (default: compact)\n");
+       exit(EXIT_FAILURE);
+    }
+    maxthreads = atoi(argv[optind]);
+    iters = atol(argv[optind + 1]);
+    rates = (double*)malloc_safe(reps * sizeof(double));
+
+    pi = procmap_init();
+    pl = placement_init(pi, placement_spec);
+    if ( !pl ) {
+        fprintf(stderr, "Invalid placement: %s\n", placement_spec);
+        exit(EXIT_FAILURE);
+    }
+    ncpus = pl->nslots;
+    cpusets = (cpu_set_t*)malloc_safe(ncpus * sizeof(cpu_set_t));
+    packages = (int*)malloc_safe(ncpus * sizeof(int));
+    cores = (int*)malloc_safe(ncpus * sizeof(int));
+    for ( i = 0; i < ncpus; i++ ) {
+        CPU_ZERO(&cpusets[i]);
+        CPU_SET(pl->slots[i].cpu_id, &cpusets[i]);
+        packages[i] = pl->slots[i].package;
+        cores[i] = pl->slots[i].core;
+    }
+    placement_print(pl, stdout);
+
+    fprintf(stdout, "Workload: imbalance_cycles:%lu\n", imbalance_cycles);
+
+    // For all different thread numbers
+    fprintf(stdout, "\n");
+    for ( nthreads = 1; nthreads <= maxthreads; nthreads++ ) {
+
+        fprintf(stdout, "Nthreads=%d\n", nthreads);
+        fprintf(stdout, "==============\n");
+
+        // allocate thread structures
+        tids = (pthread_t*)malloc_safe( nthreads * sizeof(pthread_t) );
+        targs = (targs_t*)malloc_safe( nthreads * sizeof(targs_t));
+        attr = (pthread_attr_t*)malloc_safe( nthreads * sizeof(pthread_attr_t));
+        thread_packages = (int*)malloc_safe( nthreads * sizeof(int));
+        thread_cores = (int*)malloc_safe( nthreads * sizeof(int));
+        pthread_barrier_init(&bar, NULL, nthreads);
+
+        // for all different barriers
+        for ( op = 0; ; op++ ) {
+            if ( ops[op].code == NO_OP ) break;
+            // spinning waiters would only measure the scheduler quantum
+            if ( nthreads > ncpus && !ops[op].blocking )
+                continue;
+
+            fprintf(stdout, "\tnthreads:%d \tbarrier:%s ",
+                            nthreads, ops[op].name);
+
+            // warm-up runs are discarded
+            for ( rep = -warmups; rep < reps; rep++ ) {
+                run_op(&ops[op], nthreads);
+                if ( rep < 0 )
+                    continue;
+                rates[rep] = iters * timer_read_hz() / timer_total(&tim);
+            }
+            stats_compute(&rate, rates, reps);
+
+            // the remaining metrics refer to the last run
+            wait_cycles = 0;
+            for ( i = 0; i < nthreads; i++ )
+                wait_cycles += targs[i].wait_cycles;
+
+            // cycles per episode include the imbalance work; wait_cycles
+            // is the time a thread spends in the barrier per episode
+            fprintf(stdout, "\tcycles:%lf \twait_cycles:%lf",
+                            timer_total(&tim) / (double)iters,
+                            wait_cycles / ((double)iters * nthreads));
+            if ( reps > 1 )
+                fprintf(stdout, " \tepisodes_per_sec:%lf \tstddev:%lf \tci95:%lf \truns:%d",
+                                rate.mean, rate.stddev, rate.ci95, reps);
+            fprintf(stdout, "\n");
+        }
+
+        pthread_barrier_destroy(&bar);
+        free(tids);
+        free(targs);
+        free(attr);
+        free(thread_packages);
+        free(thread_cores);
+
+        fprintf(stdout, "\n");
+    }
+
+    placement_destroy(pl);
+    procmap_destroy(pi);
+    free(rates);
+    free(cpusets);
+    free(packages);
+    free(cores);
+
+    return 0;
+}
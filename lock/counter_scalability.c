@@ -0,0 +1,354 @@
+/**
+ * @file
+ * Tests scalability of shared counters and non-zero indicators
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "synch.h"
+#include "bench/stats.h"
+#include "bench/placement.h"
+#include "bench/perf_counters.h"
+#include "util/tsc_x86_64.h"
+#include "util/processor_map.h"
+#include "util/util.h"
+
+// updates per thread
+unsigned long iters;
+// read the counter (query the indicator) once every _read_every_
+// updates, 0 for never
+unsigned long read_every = 0;
+// cycles of private work between updates
+unsigned long think_cycles = 0;
+// threads (cpus) per SNZI leaf
+int leaf_share = 2;
+
+// measured runs per configuration, and discarded warm-up runs before them
+int reps = 1;
+int warmups = 0;
+pthread_barrier_t bar;
+tsctimer_t tim;
+
+typedef struct {
+    unsigned long word;
+} __attribute__ ((aligned (64))) shared_word_t;
+
+shared_word_t counter;
+sharded_counter_t scounter;
+snzi_t snzi;
+
+typedef enum {
+    NO_OP = 0,
+    LOCK_INCL,
+    XADD,
+    CAS_LOOP,
+    SHARDED_COUNTER,
+    CENTRAL_INDICATOR,
+    SNZI
+} opcode_t;
+
+typedef struct {
+    opcode_t code;
+    char *name;
+    //! final value must equal the number of updates
+    int counts;
+} op_desc_t;
+
+#define INIT_OP(o) {.code = o, .name = #o}
+#define INIT_COUNTING_OP(o) {.code = o, .name = #o, .counts = 1}
+
+op_desc_t ops[] = {
+    INIT_COUNTING_OP(LOCK_INCL),
+    INIT_COUNTING_OP(XADD),
+    INIT_COUNTING_OP(CAS_LOOP),
+    INIT_COUNTING_OP(SHARDED_COUNTER),
+    // arrive / depart pairs, as a counter-based non-zero indicator
+    INIT_OP(CENTRAL_INDICATOR),
+    INIT_OP(SNZI),
+    INIT_OP(NO_OP)
+};
+
+typedef struct {
+    int id;
+    //! shard (cpu slot) and SNZI leaf of the thread
+    int shard;
+    int leaf;
+    op_desc_t *od;
+    //! keeps the reads from being optimized away
+    unsigned long sink;
+    //! hardware counters of the timed region (-e)
+    perf_counters_t perf;
+} targs_t;
+
+static inline void think(void)
+{
+    if ( think_cycles )
+        spin_for_cycles(think_cycles);
+}
+
+#define COUNTER_LOOP(update, read)                          \
+    for ( i = 0; i < iters; i++ ) {                         \
+        update;                                             \
+        if ( read_every && i % read_every == 0 )            \
+            ta->sink += (read);                             \
+        think();                                            \
+    }
+
+void* thread_fn(void *args)
+{
+    unsigned long i, x;
+    targs_t *ta = (targs_t*)args;
+
+    perf_counters_open(&ta->perf);
+
+    pthread_barrier_wait(&bar);
+    if ( ta->id == 0 ) timer_start(&tim);
+    perf_counters_start(&ta->perf);
+
+    switch ( ta->od->code ) {
+
+        case LOCK_INCL:
+            COUNTER_LOOP(atomic_inc((unsigned int*)&counter.word),
+                         *(volatile unsigned long*)&counter.word);
+            break;
+
+        case XADD:
+            COUNTER_LOOP(atomic_xadd64(&counter.word, 1),
+                         *(volatile unsigned long*)&counter.word);
+            break;
+
+        case CAS_LOOP:
+            COUNTER_LOOP(
+                do {
+                    x = *(volatile unsigned long*)&counter.word;
+                } while ( atomic_cmpxchg64(&counter.word, x, x + 1) != x ),
+                *(volatile unsigned long*)&counter.word);
+            break;
+
+        case SHARDED_COUNTER:
+            COUNTER_LOOP(sharded_counter_add(&scounter, ta->shard, 1),
+                         sharded_counter_read(&scounter));
+            break;
+
+        case CENTRAL_INDICATOR:
+            COUNTER_LOOP(atomic_xadd((unsigned int*)&counter.word, 1);
+                         atomic_xadd((unsigned int*)&counter.word, -1),
+                         *(volatile unsigned long*)&counter.word != 0);
+            break;
+
+        case SNZI:
+            COUNTER_LOOP(snzi_arrive(&snzi, ta->leaf);
+                         snzi_depart(&snzi, ta->leaf),
+                         snzi_query(&snzi));
+            break;
+
+        default:
+            break;
+    }
+    perf_counters_stop(&ta->perf);
+
+    pthread_barrier_wait(&bar);
+    if ( ta->id == 0 ) timer_stop(&tim);
+    perf_counters_close(&ta->perf);
+
+    pthread_exit(NULL);
+}
+
+// per-thread state of the current thread count
+targs_t *targs;
+pthread_t *tids;
+pthread_attr_t *attr;
+
+// thread i runs on cpusets[i % ncpus]
+cpu_set_t *cpusets;
+int ncpus;
+
+/*
+ * Runs _od_ once on _nthreads_ threads; results are left in targs[]
+ */
+void run_op(op_desc_t *od, int nthreads)
+{
+    unsigned long final;
+    int i;
+
+    timer_clear(&tim);
+
+    counter.word = 0;
+    sharded_counter_init(&scounter, ncpus);
+    snzi_init(&snzi, (ncpus + leaf_share - 1) / leaf_share);
+
+    for ( i = 0; i < nthreads; i++ ) {
+        targs[i].id = i;
+        targs[i].shard = i % ncpus;
+        targs[i].leaf = (i % ncpus) / leaf_share;
+        targs[i].od = od;
+        targs[i].sink = 0;
+        pthread_attr_init(&attr[i]);
+        pthread_attr_setaffinity_np(&attr[i],
+                                    sizeof(cpu_set_t),
+                                    &cpusets[i % ncpus]);
+        pthread_create(&tids[i], &attr[i], thread_fn, (void*)&targs[i]);
+    }
+
+    for ( i = 0; i < nthreads; i++ ) {
+        pthread_join(tids[i], NULL);
+        pthread_attr_destroy(&attr[i]);
+    }
+
+    if ( od->counts ) {
+        final = od->code == SHARDED_COUNTER ? sharded_counter_read(&scounter) :
+                od->code == LOCK_INCL ? (unsigned int)counter.word :
+                                        counter.word;
+        if ( final != (od->code == LOCK_INCL ? (unsigned int)(iters * nthreads) :
+                                               iters * nthreads) )
+            fprintf(stderr, "%s: final count %lu, expected %lu\n",
+                            od->name, final, iters * nthreads);
+    }
+
+    // every arrive was matched by a depart
+    if ( od->code == CENTRAL_INDICATOR && counter.word != 0 )
+        fprintf(stderr, "%s: final count %lu, expected 0\n",
+                        od->name, counter.word);
+    if ( od->code == SNZI && snzi_query(&snzi) )
+        fprintf(stderr, "%s: indicator still non-zero\n", od->name);
+
+    sharded_counter_destroy(&scounter);
+    snzi_destroy(&snzi);
+}
+
+int main(int argc, char **argv)
+{
+    perf_counters_t perf;
+    procmap_t *pi;
+    placement_t *pl;
+    char *placement_spec = "compact";
+    int i, nthreads, maxthreads, op, opt, rep;
+    double *rates;
+    stats_t rate;
+
+    while ( (opt = getopt(argc, argv, "r:n:s:R:W:P:e:")) != -1 ) {
+        switch ( opt ) {
+            case 'r':
+                read_every = atol(optarg);
+                break;
+            case 'n':
+                think_cycles = atol(optarg);
+                break;
+            case 's':
+                leaf_share = atoi(optarg);
+                break;
+            case 'R':
+                reps = atoi(optarg);
+                break;
+            case 'W':
+                warmups = atoi(optarg);
+                break;
+            case 'P':
+                placement_spec = optarg;
+                break;
+            case 'e':
+                if ( perf_events_parse(optarg) )
+                    argc = 0;
+                break;
+            default:
+                argc = 0;
+        }
+    }
+
+    if ( argc - optind < 2 || reps < 1 || warmups < 0 || leaf_share < 1 ) {
+       printf("Usage: ./prog [-r read_every] [-n think_cycles] [-s cpus_per_snzi_leaf] "
+              "[-R reps] [-W warmups] [-P placement] [-e events] "
+              "<maxthreads> <iterations>\n");
+       printf("       placement: " PLACEMENT_USAGE " (default: compact)\n");
+       printf("       events: " PERF_EVENTS_USAGE "\n");
+       exit(EXIT_FAILURE);
+    }
+    maxthreads = atoi(argv[optind]);
+    iters = atol(argv[optind + 1]);
+    rates = (double*)malloc_safe(reps * sizeof(double));
+
+    pi = procmap_init();
+    pl = placement_init(pi, placement_spec);
+    if ( !pl ) {
+        fprintf(stderr, "Invalid placement: %s\n", placement_spec);
+        exit(EXIT_FAILURE);
+    }
+    ncpus = pl->nslots;
+    cpusets = (cpu_set_t*)malloc_safe(ncpus * sizeof(cpu_set_t));
+    for ( i = 0; i < ncpus; i++ ) {
+        CPU_ZERO(&cpusets[i]);
+        CPU_SET(pl->slots[i].cpu_id, &cpusets[i]);
+    }
+    placement_print(pl, stdout);
+    perf_events_check(stderr);
+
+    fprintf(stdout, "Workload: read_every:%lu think_cycles:%lu cpus_per_snzi_leaf:%d\n",
+                    read_every, think_cycles, leaf_share);
+
+    // For all different thread numbers
+    fprintf(stdout, "\n");
+    for ( nthreads = 1; nthreads <= maxthreads; nthreads++ ) {
+
+        fprintf(stdout, "Nthreads=%d\n", nthreads);
+        fprintf(stdout, "==============\n");
+
+        // allocate thread structures
+        tids = (pthread_t*)malloc_safe( nthreads * sizeof(pthread_t) );
+        targs = (targs_t*)malloc_safe( nthreads * sizeof(targs_t));
+        attr = (pthread_attr_t*)malloc_safe( nthreads * sizeof(pthread_attr_t));
+        pthread_barrier_init(&bar, NULL, nthreads);
+
+        // for all different counters
+        for ( op = 0; ; op++ ) {
+            if ( ops[op].code == NO_OP ) break;
+
+            fprintf(stdout, "\tnthreads:%d \tcounter:%s ",
+                            nthreads, ops[op].name);
+
+            // warm-up runs are discarded
+            for ( rep = -warmups; rep < reps; rep++ ) {
+                run_op(&ops[op], nthreads);
+                if ( rep < 0 )
+                    continue;
+                rates[rep] = iters * nthreads * timer_read_hz() / timer_total(&tim);
+            }
+            stats_compute(&rate, rates, reps);
+
+            // the remaining metrics refer to the last run
+            perf_counters_clear(&perf);
+            for ( i = 0; i < nthreads; i++ )
+                perf_counters_merge(&perf, &targs[i].perf);
+
+            // cycles per update of a thread
+            fprintf(stdout, "\tcycles:%lf",
+                            timer_total(&tim) / (double)iters);
+            if ( reps > 1 )
+                fprintf(stdout, " \tops_per_sec:%lf \tstddev:%lf \tci95:%lf \truns:%d",
+                                rate.mean, rate.stddev, rate.ci95, reps);
+            perf_counters_report(stdout, &perf, (double)iters * nthreads);
+            fprintf(stdout, "\n");
+        }
+
+        pthread_barrier_destroy(&bar);
+        free(tids);
+        free(targs);
+        free(attr);
+
+        fprintf(stdout, "\n");
+    }
+
+    placement_destroy(pl);
+    procmap_destroy(pi);
+    free(rates);
+    free(cpusets);
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ *  Server side of the delegation lock, see delegation.h.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "delegation.h"
+
+static void* deleg_server(void *args)
+{
+    deleg_t *d = (deleg_t*)args;
+    deleg_request_t *r;
+    void *data;
+    int i, idle;
+
+    for (;;) {
+        idle = 1;
+        for ( i = 0; i < d->nclients; i++ ) {
+            if ( ff_dequeue(&d->channels[i], &data) )
+                continue;
+            r = (deleg_request_t*)data;
+            r->ret = r->fn(r->arg);
+            r->done = 1;
+            d->served++;
+            idle = 0;
+        }
+        // only stop on an idle sweep, once all requests are served
+        if ( idle ) {
+            if ( d->stop )
+                break;
+            cpu_relax();
+        }
+    }
+
+    return NULL;
+}
+
+void deleg_init(deleg_t *d, int nclients)
+{
+    int i;
+
+    d->nclients = nclients;
+    if ( posix_memalign((void**)&d->channels, 64,
+                        nclients * sizeof(ff_queue_t)) ||
+         posix_memalign((void**)&d->requests, 64,
+                        nclients * sizeof(deleg_request_t)) ) {
+        fprintf(stderr, "%s: Allocation error\n", __FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    for ( i = 0; i < nclients; i++ ) {
+        ff_init(&d->channels[i], DELEG_CHANNEL_SIZE);
+        d->requests[i].done = 0;
+    }
+    d->served = 0;
+    d->stop = 0;
+}
+
+/*
+ *  Starts the server thread on _cpus_ (which the clients should
+ *  not use: it never sleeps)
+ */
+void deleg_start(deleg_t *d, cpu_set_t *cpus)
+{
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), cpus);
+    if ( pthread_create(&d->server, &attr, deleg_server, (void*)d) ) {
+        fprintf(stderr, "%s: Cannot create server thread\n", __FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+// Waits for the server to serve all enqueued requests and exit
+void deleg_stop(deleg_t *d)
+{
+    d->stop = 1;
+    pthread_join(d->server, NULL);
+}
+
+void deleg_destroy(deleg_t *d)
+{
+    int i;
+
+    for ( i = 0; i < d->nclients; i++ )
+        ff_destroy(&d->channels[i]);
+    free(d->channels);
+    free(d->requests);
+}
@@ -0,0 +1,83 @@
+#ifndef DELEGATION_H_
+#define DELEGATION_H_
+
+/*
+ *  Delegation lock, in the style of remote core locking (Lozi,
+ *  David, Thomas, Lawall and Muller, USENIX ATC 2012).
+ *  Critical sections are not run by the threads that need them but
+ *  shipped, as closures, to a server thread pinned to a dedicated
+ *  core. Each client owns a FastForward SPSC channel (ff_queue_t)
+ *  to the server and a request record that doubles as its reply
+ *  slot: it fills in the closure, enqueues the record and spins
+ *  until the server marks it done. The server polls the channels
+ *  round-robin and runs the closures one after the other, so they
+ *  are mutually exclusive, and the protected data never leaves the
+ *  server's cache; only the request and reply lines move.
+ *
+ *  Link delegation.o and ff_queue.o; cpu_set_t needs _GNU_SOURCE.
+ *
+ *  example:
+ *      long fn(void *arg) { ...critical section... }
+ *      deleg_t d;                                  //shared
+ *      deleg_init(&d, nclients);
+ *      deleg_start(&d, &server_cpus);
+ *      ...
+ *      ret = deleg_execute(&d, my_id, fn, arg);    //client my_id
+ *      ...
+ *      deleg_stop(&d);
+ *      deleg_destroy(&d);
+ */
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "lock.h"
+#include "queue/ff_queue.h"
+
+// slots per client channel; a client has one request outstanding
+#define DELEG_CHANNEL_SIZE  16
+
+typedef long (*deleg_fn_t)(void *arg);
+
+typedef struct {
+    //! closure to run on the server
+    deleg_fn_t fn;
+    void *arg;
+    //! reply slot: _ret_ is valid once _done_ is set by the server
+    volatile long ret;
+    volatile int done;
+} __attribute__ ((aligned (64))) deleg_request_t;
+
+typedef struct {
+    int nclients;
+    //! per-client channels (client to server) and request records
+    ff_queue_t *channels;
+    deleg_request_t *requests;
+    //! requests run by the server
+    unsigned long served;
+    volatile int stop __attribute__ ((aligned (64)));
+    pthread_t server;
+} deleg_t;
+
+extern void deleg_init(deleg_t *d, int nclients);
+extern void deleg_start(deleg_t *d, cpu_set_t *cpus);
+extern void deleg_stop(deleg_t *d);
+extern void deleg_destroy(deleg_t *d);
+
+// Runs _fn(arg)_ on the server on behalf of client _id_ and returns its result
+static inline long deleg_execute(deleg_t *d, int id, deleg_fn_t fn, void *arg)
+{
+    deleg_request_t *r = &d->requests[id];
+
+    r->fn = fn;
+    r->arg = arg;
+    r->done = 0;
+    while ( ff_enqueue(&d->channels[id], r) == FF_WOULDBLOCK )
+        cpu_relax();
+
+    while ( !r->done )
+        cpu_relax();
+    return r->ret;
+}
+
+#endif
@@ -0,0 +1,434 @@
+/**
+ * @file
+ * Measures the latency of passing a lock between two cpus
+ *
+ * Two threads, pinned on a pair of cpus, take turns in the critical
+ * section: a thread waits until it is its turn, acquires the lock,
+ * hands the turn to its peer and releases the lock. So every
+ * acquisition finds the lock last released on the other cpu, and the
+ * waiter already spins on the turn while the holder releases.
+ * The NO_LOCK op passes just the turn, i.e. it measures the bare
+ * transfer of a cache line between the two cpus.
+ * All locks are run for every pair of cpus, and the cycles per
+ * handoff are printed as a cpu x cpu matrix, followed by the average
+ * over SMT siblings, cores of the same package and cores of different
+ * packages.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "lock.h"
+#include "util/tsc_x86_64.h"
+#include "util/processor_map.h"
+#include "util/util.h"
+
+unsigned long iters;
+pthread_barrier_t bar;
+tsctimer_t tim;
+
+// thread whose turn it is to enter the critical section
+volatile int turn __attribute__ ((aligned (64)));
+
+spinlock_t lock __attribute__ ((aligned (64)));
+backoff_lock_t backofflock;
+backoff_lock_t backofflock_jitter;
+ticketlock_t tlock __attribute__ ((aligned (64)));
+mcs_lock_t mcslock;
+clh_lock_t clhlock;
+aclh_lock_t aclhlock;
+cohort_lock_t cohortlock;
+futexlock_t futexlock __attribute__ ((aligned (64)));
+rwlock_t rwlock __attribute__ ((aligned (64)));
+rwlock_wpref_t rwlock_wpref __attribute__ ((aligned (64)));
+brlock_t brlock;
+pthread_mutex_t mutex __attribute__ ((aligned (64)));
+
+typedef enum {
+    NO_OP = 0,
+    NO_LOCK,
+    SPIN_LOCK,
+    SPIN_LOCK_ALIGNED,
+    SPIN_LOCK_ALIGNED_PAUSED,
+    SPIN_LOCK_TTAS,
+    SPIN_LOCK_TTAS_PAUSED,
+    SPIN_LOCK_TTAS_BACKOFF,
+    SPIN_LOCK_TTAS_BACKOFF_JITTER,
+    SPIN_LOCK_TTAS_YIELD,
+    SPIN_LOCK_TTAS_TIMED,
+    TICKET_LOCK,
+    TICKET_LOCK_PROP_BACKOFF,
+    TICKET_LOCK_YIELD,
+    MCS_LOCK,
+    MCS_LOCK_YIELD,
+    CLH_LOCK,
+    ACLH_LOCK,
+    COHORT_LOCK,
+    FUTEX_LOCK,
+    RW_LOCK,
+    RW_LOCK_WPREF,
+    BR_LOCK,
+    PTHREAD_MUTEX
+} opcode_t;
+
+typedef struct {
+    opcode_t code;
+    char *name;
+} op_desc_t;
+
+#define INIT_OP(o) {.code = o, .name = #o}
+
+// Every lock of lock.h, through its blocking acquire (the timed ones
+// with an unbounded budget). The *_trylock entry points never wait, so
+// they have no handoff of their own. Flat combining is not a lock:
+// a handoff would pass no lock between threads.
+op_desc_t ops[] = {
+    INIT_OP(NO_LOCK),
+    // the uncontended path of spin_lock() falls through into its
+    // spin loop and never returns (as in locks_scalability)
+    /*INIT_OP(SPIN_LOCK),*/
+    INIT_OP(SPIN_LOCK_ALIGNED),
+    INIT_OP(SPIN_LOCK_ALIGNED_PAUSED),
+    INIT_OP(SPIN_LOCK_TTAS),
+    INIT_OP(SPIN_LOCK_TTAS_PAUSED),
+    INIT_OP(SPIN_LOCK_TTAS_BACKOFF),
+    INIT_OP(SPIN_LOCK_TTAS_BACKOFF_JITTER),
+    INIT_OP(SPIN_LOCK_TTAS_YIELD),
+    INIT_OP(SPIN_LOCK_TTAS_TIMED),
+    INIT_OP(TICKET_LOCK),
+    INIT_OP(TICKET_LOCK_PROP_BACKOFF),
+    INIT_OP(TICKET_LOCK_YIELD),
+    INIT_OP(MCS_LOCK),
+    INIT_OP(MCS_LOCK_YIELD),
+    INIT_OP(CLH_LOCK),
+    INIT_OP(ACLH_LOCK),
+    INIT_OP(COHORT_LOCK),
+    INIT_OP(FUTEX_LOCK),
+    INIT_OP(RW_LOCK),
+    INIT_OP(RW_LOCK_WPREF),
+    INIT_OP(BR_LOCK),
+    INIT_OP(PTHREAD_MUTEX),
+    INIT_OP(NO_OP)
+};
+
+typedef struct {
+    int id;
+    //! package the thread runs on (cohort node)
+    int package;
+    op_desc_t *od;
+    mcs_node_t qnode;
+    clh_node_t *clhnode;
+    aclh_thread_t aclh;
+} __attribute__ ((aligned (64))) targs_t;
+
+targs_t targs[2];
+clh_node_t clhnodes[2];
+
+#define HANDOFF_LOOP(acquire, release)          \
+    for ( i = 0; i < iters; i++ ) {             \
+        while ( turn != me )                    \
+            cpu_relax();                        \
+        acquire;                                \
+        turn = peer;                            \
+        release;                                \
+    }
+
+void* thread_fn(void *args)
+{
+    unsigned long i;
+    targs_t *ta = (targs_t*)args;
+    int me = ta->id, peer = !ta->id;
+
+    pthread_barrier_wait(&bar);
+    if ( ta->id == 0 ) timer_start(&tim);
+
+    switch ( ta->od->code ) {
+
+        case NO_LOCK:
+            HANDOFF_LOOP( , );
+            break;
+
+        case SPIN_LOCK:
+            HANDOFF_LOOP(spin_lock(&lock), spin_unlock(&lock));
+            break;
+
+        case SPIN_LOCK_ALIGNED:
+            HANDOFF_LOOP(spin_lock_aligned(&lock), spin_unlock(&lock));
+            break;
+
+        case SPIN_LOCK_ALIGNED_PAUSED:
+            HANDOFF_LOOP(spin_lock_aligned_pause(&lock), spin_unlock(&lock));
+            break;
+
+        case SPIN_LOCK_TTAS:
+            HANDOFF_LOOP(spin_lock_cas(&lock), spin_unlock(&lock));
+            break;
+
+        case SPIN_LOCK_TTAS_PAUSED:
+            HANDOFF_LOOP(spin_lock_cas_pause(&lock), spin_unlock(&lock));
+            break;
+
+        case SPIN_LOCK_TTAS_BACKOFF:
+            HANDOFF_LOOP(backoff_lock(&backofflock),
+                         backoff_unlock(&backofflock));
+            break;
+
+        case SPIN_LOCK_TTAS_BACKOFF_JITTER:
+            HANDOFF_LOOP(backoff_lock(&backofflock_jitter),
+                         backoff_unlock(&backofflock_jitter));
+            break;
+
+        case SPIN_LOCK_TTAS_YIELD:
+            HANDOFF_LOOP(spin_lock_yield(&lock), spin_unlock(&lock));
+            break;
+
+        case SPIN_LOCK_TTAS_TIMED:
+            HANDOFF_LOOP(spin_lock_timed(&lock, (unsigned long)-1),
+                         spin_unlock(&lock));
+            break;
+
+        case TICKET_LOCK:
+            HANDOFF_LOOP(ticket_lock(&tlock), ticket_unlock(&tlock));
+            break;
+
+        case TICKET_LOCK_PROP_BACKOFF:
+            HANDOFF_LOOP(ticket_lock_backoff(&tlock), ticket_unlock(&tlock));
+            break;
+
+        case TICKET_LOCK_YIELD:
+            HANDOFF_LOOP(ticket_lock_yield(&tlock), ticket_unlock(&tlock));
+            break;
+
+        case MCS_LOCK:
+            HANDOFF_LOOP(mcs_lock(&mcslock, &ta->qnode),
+                         mcs_unlock(&mcslock, &ta->qnode));
+            break;
+
+        case MCS_LOCK_YIELD:
+            HANDOFF_LOOP(mcs_lock_yield(&mcslock, &ta->qnode),
+                         mcs_unlock_yield(&mcslock, &ta->qnode));
+            break;
+
+        case CLH_LOCK:
+            HANDOFF_LOOP(clh_lock(&clhlock, &ta->clhnode),
+                         clh_unlock(&clhlock, &ta->clhnode));
+            break;
+
+        case ACLH_LOCK:
+            HANDOFF_LOOP(aclh_lock(&aclhlock, &ta->aclh),
+                         aclh_unlock(&aclhlock, &ta->aclh));
+            break;
+
+        case COHORT_LOCK:
+            HANDOFF_LOOP(cohort_lock(&cohortlock, ta->package),
+                         cohort_unlock(&cohortlock, ta->package));
+            break;
+
+        case FUTEX_LOCK:
+            HANDOFF_LOOP(futex_lock(&futexlock), futex_unlock(&futexlock));
+            break;
+
+        case RW_LOCK:
+            HANDOFF_LOOP(rw_write_lock(&rwlock), rw_write_unlock(&rwlock));
+            break;
+
+        case RW_LOCK_WPREF:
+            HANDOFF_LOOP(rw_wpref_write_lock(&rwlock_wpref),
+                         rw_wpref_write_unlock(&rwlock_wpref));
+            break;
+
+        case BR_LOCK:
+            HANDOFF_LOOP(br_write_lock(&brlock), br_write_unlock(&brlock));
+            break;
+
+        case PTHREAD_MUTEX:
+            HANDOFF_LOOP(pthread_mutex_lock(&mutex),
+                         pthread_mutex_unlock(&mutex));
+            break;
+
+        default:
+            break;
+    }
+
+    pthread_barrier_wait(&bar);
+    if ( ta->id == 0 ) timer_stop(&tim);
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Runs _od_ with threads pinned on _cpu0_ and _cpu1_
+ * @return cycles per handoff
+ */
+double run_pair(op_desc_t *od, int cpu0, int pkg0, int cpu1, int pkg1)
+{
+    pthread_t tids[2];
+    pthread_attr_t attr[2];
+    cpu_set_t cpuset;
+    int cpus[2] = {cpu0, cpu1}, pkgs[2] = {pkg0, pkg1};
+    int i;
+
+    timer_clear(&tim);
+    turn = 0;
+
+    spin_lock_init(&lock);
+    backoff_lock_init(&backofflock, 4, 1024, 0);
+    backoff_lock_init(&backofflock_jitter, 4, 1024, 1);
+    ticket_lock_init(&tlock);
+    mcs_lock_init(&mcslock);
+    clh_lock_init(&clhlock);
+    aclh_lock_init(&aclhlock);
+    cohort_lock_init(&cohortlock, COHORT_DEFAULT_HANDOFFS);
+    futex_lock_init(&futexlock);
+    rw_lock_init(&rwlock);
+    rw_wpref_lock_init(&rwlock_wpref);
+    br_lock_init(&brlock, 2);
+    pthread_mutex_init(&mutex, NULL);
+
+    for ( i = 0; i < 2; i++ ) {
+        targs[i].id = i;
+        targs[i].package = pkgs[i];
+        targs[i].od = od;
+        mcs_node_init(&targs[i].qnode);
+        targs[i].clhnode = &clhnodes[i];
+        aclh_thread_init(&targs[i].aclh);
+        CPU_ZERO(&cpuset);
+        CPU_SET(cpus[i], &cpuset);
+        pthread_attr_init(&attr[i]);
+        pthread_attr_setaffinity_np(&attr[i], sizeof(cpuset), &cpuset);
+        pthread_create(&tids[i], &attr[i], thread_fn, (void*)&targs[i]);
+    }
+    for ( i = 0; i < 2; i++ ) {
+        pthread_join(tids[i], NULL);
+        pthread_attr_destroy(&attr[i]);
+    }
+    for ( i = 0; i < 2; i++ )
+        aclh_thread_destroy(&aclhlock, &targs[i].aclh);
+    aclh_lock_destroy(&aclhlock);
+    pthread_mutex_destroy(&mutex);
+
+    // each thread hands the lock over once per iteration
+    return timer_total(&tim) / (2.0 * iters);
+}
+
+// distance classes of a cpu pair
+enum { SMT = 0, PACKAGE, CROSS, NDISTANCES };
+char *distance_names[] = { "smt", "package", "cross_package" };
+
+int main(int argc, char **argv)
+{
+    procmap_t *pi;
+    int p, c, t, i, j, n, op, opt;
+    char *only = NULL;
+    double *lat, sum[NDISTANCES];
+    int cnt[NDISTANCES];
+
+    while ( (opt = getopt(argc, argv, "l:")) != -1 ) {
+        switch ( opt ) {
+            case 'l':
+                only = optarg;
+                break;
+            default:
+                argc = 0;
+        }
+    }
+
+    if ( argc - optind < 1 ) {
+       printf("Usage: ./prog [-l lock] <iterations>\n");
+       exit(EXIT_FAILURE);
+    }
+
+    iters = atol(argv[optind]);
+
+    pi = procmap_init();
+    n = pi->num_cpus;
+    if ( n < 2 ) {
+        fprintf(stderr, "Need at least 2 cpus. Exiting\n");
+        exit(EXIT_FAILURE);
+    }
+    int cpus[n], pkgs[n], cores[n];
+    lat = (double*)malloc_safe(n * n * sizeof(double));
+
+    // Number cpus so that SMT siblings and cores of the same
+    // package are adjacent in the matrix
+    i = 0;
+    fprintf(stdout, "Cpu numbering:\n");
+    for ( p = 0; p < pi->num_packages; p++ ) {
+        for ( c = 0; c < pi->num_cores_per_package; c++ ) {
+            for ( t = 0; t < pi->num_threads_per_core; t++ ) {
+                cpus[i] = pi->package[p].core[c].thread[t]->cpu_id;
+                pkgs[i] = p;
+                cores[i] = p * pi->num_cores_per_package + c;
+
+                fprintf(stdout, "Cpu %d @ package %d, core %d, "
+                                "hw thread %d (cpuid: %d)\n",
+                                i, p, c, t, cpus[i]);
+                i++;
+            }
+        }
+    }
+    fprintf(stdout, "\n");
+
+    pthread_barrier_init(&bar, NULL, 2);
+    for ( op = 0; ; op++ ) {
+        if ( ops[op].code == NO_OP ) break;
+        if ( only && strcmp(only, ops[op].name) ) continue;
+
+        // the two directions are symmetric, so measure each pair once
+        for ( i = 0; i < n; i++ ) {
+            lat[i * n + i] = 0;
+            for ( j = i + 1; j < n; j++ ) {
+                lat[i * n + j] = run_pair(&ops[op],
+                                          cpus[i], pkgs[i] % COHORT_MAX_NODES,
+                                          cpus[j], pkgs[j] % COHORT_MAX_NODES);
+                lat[j * n + i] = lat[i * n + j];
+            }
+        }
+
+        fprintf(stdout, "lock:%s iters:%lu cycles per handoff\n",
+                        ops[op].name, iters);
+        fprintf(stdout, "%6s", "");
+        for ( j = 0; j < n; j++ )
+            fprintf(stdout, " %8d", j);
+        fprintf(stdout, "\n");
+        for ( i = 0; i < n; i++ ) {
+            fprintf(stdout, "%6d", i);
+            for ( j = 0; j < n; j++ ) {
+                if ( i == j )
+                    fprintf(stdout, " %8s", "-");
+                else
+                    fprintf(stdout, " %8.1lf", lat[i * n + j]);
+            }
+            fprintf(stdout, "\n");
+        }
+
+        memset(sum, 0, sizeof(sum));
+        memset(cnt, 0, sizeof(cnt));
+        for ( i = 0; i < n; i++ ) {
+            for ( j = i + 1; j < n; j++ ) {
+                int d = cores[i] == cores[j] ? SMT :
+                        pkgs[i] == pkgs[j] ? PACKAGE : CROSS;
+                sum[d] += lat[i * n + j];
+                cnt[d]++;
+            }
+        }
+        fprintf(stdout, "lock:%s", ops[op].name);
+        for ( i = 0; i < NDISTANCES; i++ )
+            if ( cnt[i] )
+                fprintf(stdout, " \t%s:%lf", distance_names[i], sum[i] / cnt[i]);
+        fprintf(stdout, "\n\n");
+    }
+
+    pthread_barrier_destroy(&bar);
+    free(lat);
+    procmap_destroy(pi);
+
+    return 0;
+}
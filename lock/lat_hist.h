@@ -0,0 +1,110 @@
+/**
+ * @file
+ * Log-bucketed latency histograms
+ *
+ * Values are bucketed by their most significant bit, and every
+ * power-of-two range is further split into LAT_HIST_SUB linear
+ * sub-buckets, so a bucket is never wider than 1/LAT_HIST_SUB of
+ * the values it holds. Recording is a handful of ALU ops and one
+ * increment on a thread-private histogram; histograms of different
+ * threads are merged after the run.
+ */
+#ifndef LAT_HIST_H_
+#define LAT_HIST_H_
+
+#include <string.h>
+
+#define LAT_HIST_SUB_BITS   3
+#define LAT_HIST_SUB        (1 << LAT_HIST_SUB_BITS)
+#define LAT_HIST_BUCKETS    ((64 - LAT_HIST_SUB_BITS + 1) * LAT_HIST_SUB)
+
+typedef struct {
+    //! number of samples per bucket
+    unsigned long count[LAT_HIST_BUCKETS];
+    //! total number of samples
+    unsigned long samples;
+    //! largest sample
+    unsigned long max;
+} lat_hist_t;
+
+static inline void lat_hist_clear(lat_hist_t *h)
+{
+    memset(h, 0, sizeof(lat_hist_t));
+}
+
+static inline int lat_hist_bucket(unsigned long v)
+{
+    int msb, shift;
+
+    if ( v < LAT_HIST_SUB )
+        return (int)v;
+
+    msb = 63 - __builtin_clzl(v);
+    shift = msb - LAT_HIST_SUB_BITS;
+
+    return ((shift + 1) << LAT_HIST_SUB_BITS) +
+           (int)((v >> shift) & (LAT_HIST_SUB - 1));
+}
+
+// Largest value that falls in bucket _b_
+static inline unsigned long lat_hist_bucket_top(int b)
+{
+    int shift = (b >> LAT_HIST_SUB_BITS) - 1;
+    unsigned long low;
+
+    if ( shift < 0 )
+        return (unsigned long)b;
+
+    low = (unsigned long)(LAT_HIST_SUB + (b & (LAT_HIST_SUB - 1))) << shift;
+    return low + ((1UL << shift) - 1);
+}
+
+static inline void lat_hist_add(lat_hist_t *h, unsigned long v)
+{
+    h->count[lat_hist_bucket(v)]++;
+    h->samples++;
+    if ( v > h->max )
+        h->max = v;
+}
+
+static inline void lat_hist_merge(lat_hist_t *dst, lat_hist_t *src)
+{
+    int b;
+
+    for ( b = 0; b < LAT_HIST_BUCKETS; b++ )
+        dst->count[b] += src->count[b];
+    dst->samples += src->samples;
+    if ( src->max > dst->max )
+        dst->max = src->max;
+}
+
+/**
+ * Returns (an upper bound of) the p-th quantile, 0 < p <= 1
+ * @param h histogram
+ * @param p quantile, e.g. 0.99
+ * @return the top of the bucket holding the quantile, or the
+ *         exact maximum if that is smaller
+ */
+static inline unsigned long lat_hist_quantile(lat_hist_t *h, double p)
+{
+    unsigned long rank, seen = 0, top;
+    int b;
+
+    if ( h->samples == 0 )
+        return 0;
+
+    rank = (unsigned long)(p * h->samples);
+    if ( rank < p * h->samples || rank == 0 )
+        rank++;
+
+    for ( b = 0; b < LAT_HIST_BUCKETS; b++ ) {
+        seen += h->count[b];
+        if ( seen >= rank )
+            break;
+    }
+
+    top = lat_hist_bucket_top(b);
+    return top < h->max ? top : h->max;
+}
+
+#endif
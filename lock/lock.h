@@ -1,6 +1,110 @@
 #ifndef LOCK_H_
 #define LOCK_H_
 
+#include <linux/futex.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Return codes of the trylock / lock_timed entry points (0 means acquired)
+#define LOCK_BUSY       1
+#define LOCK_TIMEDOUT   2
+
+static inline void cpu_relax(void)
+{
+    __asm__ __volatile__ ("pause" ::: "memory");
+}
+
+/*
+ *  Spin budget of the *_yield lock variants: a waiter pauses 
+ *  LOCK_YIELD_SPINS times and then gives up its cpu with 
+ *  sched_yield(), so that a preempted lock holder (or the waiter
+ *  next in line, for FIFO locks) gets to run when threads 
+ *  outnumber cpus.
+ *
+ */
+#define LOCK_YIELD_SPINS    128
+
+static inline void cpu_relax_or_yield(unsigned int *spins)
+{
+    if ( ++*spins < LOCK_YIELD_SPINS ) {
+        cpu_relax();
+    } else {
+        *spins = 0;
+        sched_yield();
+    }
+}
+
+static inline unsigned long lock_read_tsc(void)
+{
+    unsigned int lo, hi;
+
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((unsigned long)hi << 32) | lo;
+}
+
+// If *ptr == old, store _new_ to *ptr; returns the previous value of *ptr
+static inline unsigned int cmpxchg_u32(volatile unsigned int *ptr, 
+                                       unsigned int old, unsigned int new)
+{
+    unsigned int prev;
+
+    __asm__ __volatile__ ("lock; cmpxchgl %2, %1"
+        : "=a" (prev), "+m" (*ptr)
+        : "r" (new), "0" (old)
+        : "memory");
+
+    return prev;
+}
+
+// Atomically store _val_ to *ptr and return its previous value
+static inline unsigned int xchg_u32(volatile unsigned int *ptr, unsigned int val)
+{
+    __asm__ __volatile__ ("xchgl %0, %1"
+        : "+r" (val), "+m" (*ptr)
+        :
+        : "memory");
+
+    return val;
+}
+
+// Atomically add _val_ to *ptr and return its previous value
+static inline int fetch_add_int(volatile int *ptr, int val)
+{
+    __asm__ __volatile__ ("lock; xaddl %0, %1"
+        : "+r" (val), "+m" (*ptr)
+        :
+        : "memory");
+
+    return val;
+}
+
+// Atomically store _val_ to *ptr and return its previous value
+static inline void* xchg_ptr(void * volatile *ptr, void *val)
+{
+    __asm__ __volatile__ ("xchgq %0, %1"
+        : "+r" (val), "+m" (*ptr)
+        :
+        : "memory");
+
+    return val;
+}
+
+// If *ptr == old, store _new_ to *ptr; returns the previous value of *ptr
+static inline void* cmpxchg_ptr(void * volatile *ptr, void *old, void *new)
+{
+    void *prev;
+
+    __asm__ __volatile__ ("lock; cmpxchgq %2, %1"
+        : "=a" (prev), "+m" (*ptr)
+        : "r" (new), "0" (old)
+        : "memory");
+
+    return prev;
+}
+
 typedef volatile unsigned int spinlock_t;
 
 #define SPIN_LOCK_UNLOCKED  1 
@@ -132,4 +236,1017 @@ static inline void spin_lock_cas_pause(spinlock_t *spin_var)
 }
 
 
+/*
+ *  Non-blocking acquire for all the spinlock_t variants above:
+ *  test first, then try the swap once. Returns 0 if the lock
+ *  was acquired, LOCK_BUSY otherwise.
+ *
+ */
+static inline int spin_trylock(spinlock_t *spin_var)
+{
+    unsigned int old = SPIN_LOCK_LOCKED;
+
+    if ( *spin_var != SPIN_LOCK_UNLOCKED )
+        return LOCK_BUSY;
+
+    __asm__ __volatile__ ("xchgl %0, %1"
+        : "+r" (old), "+m" (*spin_var)
+        :
+        : "memory");
+
+    return old == SPIN_LOCK_UNLOCKED ? 0 : LOCK_BUSY;
+}
+
+/*
+ *  Test-and-test-and-set acquire that gives up after _cycles_ 
+ *  TSC cycles. Returns 0 if the lock was acquired, LOCK_TIMEDOUT 
+ *  otherwise.
+ *
+ */
+static inline int spin_lock_timed(spinlock_t *spin_var, unsigned long cycles)
+{
+    unsigned long start = lock_read_tsc();
+
+    for (;;) {
+        if ( spin_trylock(spin_var) == 0 )
+            return 0;
+        while ( *spin_var != SPIN_LOCK_UNLOCKED ) {
+            if ( lock_read_tsc() - start >= cycles )
+                return LOCK_TIMEDOUT;
+            cpu_relax();
+        }
+    }
+}
+
+// Test-and-test-and-set acquire that yields after a spin budget
+static inline void spin_lock_yield(spinlock_t *spin_var)
+{
+    unsigned int spins = 0;
+
+    while ( spin_trylock(spin_var) ) {
+        while ( *spin_var != SPIN_LOCK_UNLOCKED )
+            cpu_relax_or_yield(&spins);
+    }
+}
+
+/*
+ *  Test-and-test-and-set lock with bounded exponential backoff.
+ *  After every failed test-and-set a thread waits for a number of
+ *  pauses that starts at _min_backoff_ and doubles on each retry,
+ *  up to _max_backoff_. With _jitter_ set, every wait is drawn 
+ *  uniformly from [backoff/2, backoff], so that threads that failed
+ *  together do not all retry together. Limits are set at init and
+ *  live on their own cache line, away from the lock word.
+ *  Released with backoff_unlock().
+ *
+ */
+
+typedef struct {
+    spinlock_t lock __attribute__ ((aligned (64)));
+    unsigned int min_backoff __attribute__ ((aligned (64)));
+    unsigned int max_backoff;
+    int jitter;
+} backoff_lock_t;
+
+static inline void backoff_lock_init(backoff_lock_t *bl, unsigned int min_backoff,
+                                     unsigned int max_backoff, int jitter)
+{
+    spin_lock_init(&bl->lock);
+    bl->min_backoff = min_backoff ? min_backoff : 1;
+    bl->max_backoff = max_backoff > bl->min_backoff ? max_backoff : bl->min_backoff;
+    bl->jitter = jitter;
+}
+
+static inline void backoff_lock(backoff_lock_t *bl)
+{
+    unsigned int backoff = bl->min_backoff, wait, i;
+    unsigned int seed = 0;
+
+    for (;;) {
+        while ( bl->lock != SPIN_LOCK_UNLOCKED )
+            cpu_relax();
+        if ( spin_trylock(&bl->lock) == 0 )
+            return;
+
+        wait = backoff;
+        if ( bl->jitter ) {
+            // xorshift, seeded lazily from the TSC on first contention
+            if ( !seed ) 
+                seed = (unsigned int)lock_read_tsc() | 1;
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            wait = backoff / 2 + seed % (backoff - backoff / 2 + 1);
+        }
+        for ( i = 0; i < wait; i++ )
+            cpu_relax();
+
+        if ( backoff < bl->max_backoff ) {
+            backoff *= 2;
+            if ( backoff > bl->max_backoff )
+                backoff = bl->max_backoff;
+        }
+    }
+}
+
+static inline int backoff_trylock(backoff_lock_t *bl)
+{
+    return spin_trylock(&bl->lock);
+}
+
+static inline void backoff_unlock(backoff_lock_t *bl)
+{
+    spin_unlock(&bl->lock);
+}
+
+
+/*
+ *  Ticket lock: each thread atomically takes the next ticket
+ *  (lock; xaddl on _next_) and spins until _owner_ reaches it.
+ *  Threads are served in FIFO order, and since only the holder
+ *  ever writes _owner_, the release is a plain increment.
+ *
+ */
+
+typedef struct {
+    volatile unsigned int next;
+    volatile unsigned int owner;
+} ticketlock_t;
+
+// Pause iterations per waiter ahead of us (proportional backoff)
+#define TICKET_BACKOFF_BASE 64
+
+static inline void ticket_lock_init(ticketlock_t *tl)
+{
+    tl->next = 0;
+    tl->owner = 0;
+}
+
+static inline unsigned int ticket_take(ticketlock_t *tl)
+{
+    unsigned int ticket = 1;
+
+    __asm__ __volatile__ ("lock; xaddl %0, %1"
+        : "+r" (ticket), "+m" (tl->next)
+        :
+        : "memory");
+
+    return ticket;
+}
+
+static inline void ticket_lock(ticketlock_t *tl)
+{
+    unsigned int my_ticket = ticket_take(tl);
+
+    while ( tl->owner != my_ticket )
+        cpu_relax();
+}
+
+/*
+ *  Proportional backoff: a waiter that is k positions away from
+ *  the owner cannot get the lock before k critical sections have
+ *  completed, so it backs off for (k-1) * TICKET_BACKOFF_BASE pauses
+ *  before polling _owner_ again. Only the next waiter in line polls
+ *  continuously, which keeps the rest off the lock line while
+ *  ownership is handed over.
+ *
+ */
+static inline void ticket_lock_backoff(ticketlock_t *tl)
+{
+    unsigned int my_ticket = ticket_take(tl);
+    unsigned int dist, i;
+
+    for (;;) {
+        dist = my_ticket - tl->owner;
+        if ( dist == 0 )
+            break;
+        for ( i = 0; i < (dist - 1) * TICKET_BACKOFF_BASE; i++ )
+            cpu_relax();
+        cpu_relax();
+    }
+}
+
+/*
+ *  Yielding only helps when the next waiter in line is the one
+ *  that was preempted; the others still have to wait for it.
+ *
+ */
+static inline void ticket_lock_yield(ticketlock_t *tl)
+{
+    unsigned int my_ticket = ticket_take(tl);
+    unsigned int spins = 0;
+
+    while ( tl->owner != my_ticket )
+        cpu_relax_or_yield(&spins);
+}
+
+/*
+ *  A free ticket lock has next == owner. Taking ticket _owner_
+ *  with a cmpxchg on _next_ can only succeed in that state, and
+ *  then that ticket is already being served.
+ *
+ */
+static inline int ticket_trylock(ticketlock_t *tl)
+{
+    unsigned int owner = tl->owner;
+
+    if ( tl->next != owner )
+        return LOCK_BUSY;
+
+    return cmpxchg_u32(&tl->next, owner, owner + 1) == owner ? 0 : LOCK_BUSY;
+}
+
+static inline void ticket_unlock(ticketlock_t *tl)
+{
+    __asm__ __volatile__("addl $1,%0"
+            : "+m" (tl->owner)
+            :
+            : "memory");
+}
+
+/*
+ *  MCS queue lock (Mellor-Crummey and Scott, TOCS 1991).
+ *  Waiters form a linked queue of per-thread nodes: a thread
+ *  swaps its node into _tail_ and, if there was a predecessor,
+ *  links itself behind it and spins on its own _locked_ flag.
+ *  The holder hands the lock over by clearing its successor's
+ *  flag, so every waiter spins on a different cache line.
+ *
+ *  Each thread passes its own node to lock/unlock; a node may
+ *  be reused once the matching unlock has returned.
+ *
+ *  example:
+ *      mcs_lock_t l;           //shared
+ *      mcs_node_t me;          //per-thread
+ *      mcs_lock_init(&l);
+ *      ...
+ *      mcs_lock(&l, &me);
+ *      ...critical section...
+ *      mcs_unlock(&l, &me);
+ */
+
+typedef struct mcs_node_s {
+    struct mcs_node_s * volatile next;
+    volatile unsigned int locked;
+} __attribute__ ((aligned (64))) mcs_node_t;
+
+typedef struct {
+    mcs_node_t * volatile tail;
+} __attribute__ ((aligned (64))) mcs_lock_t;
+
+static inline void mcs_lock_init(mcs_lock_t *l)
+{
+    l->tail = NULL;
+}
+
+static inline void mcs_node_init(mcs_node_t *node)
+{
+    node->next = NULL;
+    node->locked = 0;
+}
+
+static inline void mcs_lock(mcs_lock_t *l, mcs_node_t *node)
+{
+    mcs_node_t *pred;
+
+    node->next = NULL;
+    node->locked = 1;
+
+    pred = (mcs_node_t*)xchg_ptr((void * volatile *)&l->tail, node);
+    if ( pred == NULL )
+        return;
+
+    pred->next = node;
+    while ( node->locked )
+        cpu_relax();
+}
+
+static inline void mcs_lock_yield(mcs_lock_t *l, mcs_node_t *node)
+{
+    mcs_node_t *pred;
+    unsigned int spins = 0;
+
+    node->next = NULL;
+    node->locked = 1;
+
+    pred = (mcs_node_t*)xchg_ptr((void * volatile *)&l->tail, node);
+    if ( pred == NULL )
+        return;
+
+    pred->next = node;
+    while ( node->locked )
+        cpu_relax_or_yield(&spins);
+}
+
+// Acquires the lock only if the queue is empty
+static inline int mcs_trylock(mcs_lock_t *l, mcs_node_t *node)
+{
+    node->next = NULL;
+    node->locked = 0;
+
+    if ( l->tail != NULL ) 
+        return LOCK_BUSY;
+
+    return cmpxchg_ptr((void * volatile *)&l->tail, NULL, node) == NULL ? 
+           0 : LOCK_BUSY;
+}
+
+static inline void mcs_unlock(mcs_lock_t *l, mcs_node_t *node)
+{
+    if ( node->next == NULL ) {
+        // No known successor: try to swing tail back to empty
+        if ( cmpxchg_ptr((void * volatile *)&l->tail, node, NULL) == node )
+            return;
+        // Someone swapped in after us; wait until it links itself
+        while ( node->next == NULL )
+            cpu_relax();
+    }
+    node->next->locked = 0;
+}
+
+// The successor may be preempted before it links itself
+static inline void mcs_unlock_yield(mcs_lock_t *l, mcs_node_t *node)
+{
+    unsigned int spins = 0;
+
+    if ( node->next == NULL ) {
+        if ( cmpxchg_ptr((void * volatile *)&l->tail, node, NULL) == node )
+            return;
+        while ( node->next == NULL )
+            cpu_relax_or_yield(&spins);
+    }
+    node->next->locked = 0;
+}
+
+/*
+ *  Cohort lock (Dice, Marathe and Shavit, PPoPP 2012), built from
+ *  ticket locks: a global lock plus one local lock per package
+ *  ("cohort"). A thread first takes the local lock of its package,
+ *  and then the global lock, unless a cohort peer passed the global 
+ *  lock on to it. On release, if another thread of the same package 
+ *  is already waiting on the local lock, the holder keeps the global
+ *  lock within the package and only releases the local one. After 
+ *  _max_handoffs_ consecutive local handoffs the global lock is 
+ *  released anyway, so that other packages do not starve.
+ *  This keeps the lock and the data it protects within one package
+ *  for long stretches, instead of bouncing them across packages on
+ *  nearly every handoff.
+ *
+ *  Callers pass the package (0 .. COHORT_MAX_NODES-1) they run on.
+ *
+ */
+
+#define COHORT_MAX_NODES            8
+#define COHORT_DEFAULT_HANDOFFS     64
+
+typedef struct {
+    ticketlock_t lock;
+    //! set when the previous holder passed the global lock to us
+    volatile unsigned int owns_global;
+    //! consecutive local handoffs (written by the local holder only)
+    unsigned int handoffs;
+} __attribute__ ((aligned (64))) cohort_node_t;
+
+typedef struct {
+    ticketlock_t global __attribute__ ((aligned (64)));
+    unsigned int max_handoffs;
+    cohort_node_t local[COHORT_MAX_NODES];
+} cohort_lock_t;
+
+static inline void cohort_lock_init(cohort_lock_t *cl, unsigned int max_handoffs)
+{
+    int i;
+
+    ticket_lock_init(&cl->global);
+    cl->max_handoffs = max_handoffs;
+    for ( i = 0; i < COHORT_MAX_NODES; i++ ) {
+        ticket_lock_init(&cl->local[i].lock);
+        cl->local[i].owns_global = 0;
+        cl->local[i].handoffs = 0;
+    }
+}
+
+static inline void cohort_lock(cohort_lock_t *cl, int pkg)
+{
+    cohort_node_t *local = &cl->local[pkg];
+
+    ticket_lock(&local->lock);
+    if ( !local->owns_global ) 
+        ticket_lock(&cl->global);
+}
+
+static inline void cohort_unlock(cohort_lock_t *cl, int pkg)
+{
+    cohort_node_t *local = &cl->local[pkg];
+    int local_waiters = local->lock.next - local->lock.owner > 1;
+
+    if ( local_waiters && local->handoffs < cl->max_handoffs ) {
+        local->handoffs++;
+        local->owns_global = 1;
+    } else {
+        local->handoffs = 0;
+        local->owns_global = 0;
+        ticket_unlock(&cl->global);
+    }
+    ticket_unlock(&local->lock);
+}
+
+
+/*
+ *  Spin-then-park futex lock (three-state mutex, see Drepper,
+ *  "Futexes Are Tricky"): _state_ is 0 when free, 1 when held
+ *  and 2 when held with (possibly) sleeping waiters.
+ *  An uncontended acquire or release is a single atomic op and
+ *  never enters the kernel. A contended acquire first spins for 
+ *  an adaptive budget; if the lock is still taken it marks the
+ *  lock contended and sleeps with FUTEX_WAIT. A release that 
+ *  finds the contended state wakes up one sleeper.
+ *  The spin budget follows glibc's adaptive mutex: twice the 
+ *  running average of the spins that preceded recent acquisitions
+ *  (plus a small constant), capped at FUTEX_LOCK_MAX_SPINS. So it
+ *  grows when the lock is typically freed shortly after, and 
+ *  shrinks when spinning ends up sleeping anyway.
+ *
+ */
+
+#define FUTEX_LOCK_MAX_SPINS    1000
+
+typedef struct {
+    volatile unsigned int state;
+    //! running average of spins before acquisition (a hint, racy)
+    volatile int spins;
+} futexlock_t;
+
+static inline long sys_futex(volatile unsigned int *uaddr, int op, 
+                             unsigned int val)
+{
+    return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+static inline void futex_lock_init(futexlock_t *fl)
+{
+    fl->state = 0;
+    fl->spins = 0;
+}
+
+static inline int futex_trylock(futexlock_t *fl)
+{
+    return cmpxchg_u32(&fl->state, 0, 1) == 0 ? 0 : LOCK_BUSY;
+}
+
+static inline void futex_lock(futexlock_t *fl)
+{
+    int cnt = 0, max_spins;
+
+    if ( cmpxchg_u32(&fl->state, 0, 1) == 0 )
+        return;
+
+    max_spins = 2 * fl->spins + 10;
+    if ( max_spins > FUTEX_LOCK_MAX_SPINS )
+        max_spins = FUTEX_LOCK_MAX_SPINS;
+
+    for ( ; cnt < max_spins; cnt++ ) {
+        cpu_relax();
+        if ( fl->state == 0 && cmpxchg_u32(&fl->state, 0, 1) == 0 ) 
+            break;
+    }
+    fl->spins += (cnt - fl->spins) / 8;
+    if ( cnt < max_spins )
+        return;
+
+    // Park: from now on we may own the lock in contended state
+    while ( xchg_u32(&fl->state, 2) != 0 )
+        sys_futex(&fl->state, FUTEX_WAIT_PRIVATE, 2);
+}
+
+static inline void futex_unlock(futexlock_t *fl)
+{
+    if ( xchg_u32(&fl->state, 0) == 2 )
+        sys_futex(&fl->state, FUTEX_WAKE_PRIVATE, 1);
+}
+
+
+/*
+ *  Reader-writer spinlock (centralized).
+ *  A single counter starts at RW_LOCK_BIAS. Readers subtract 1, 
+ *  writers subtract the whole bias: a reader gets in as long as 
+ *  the result stays positive, a writer only if it drops to zero.
+ *  A failed attempt undoes its subtraction and spins reading the
+ *  counter until it looks promising again. Readers can starve 
+ *  writers.
+ *
+ */
+
+#define RW_LOCK_BIAS    0x01000000
+
+typedef struct {
+    volatile int count;
+} rwlock_t;
+
+static inline void rw_lock_init(rwlock_t *rw)
+{
+    rw->count = RW_LOCK_BIAS;
+}
+
+static inline void rw_read_lock(rwlock_t *rw)
+{
+    for (;;) {
+        if ( fetch_add_int(&rw->count, -1) > 0 )
+            return;
+        fetch_add_int(&rw->count, 1);
+        while ( rw->count <= 0 )
+            cpu_relax();
+    }
+}
+
+static inline void rw_read_unlock(rwlock_t *rw)
+{
+    fetch_add_int(&rw->count, 1);
+}
+
+static inline void rw_write_lock(rwlock_t *rw)
+{
+    for (;;) {
+        if ( fetch_add_int(&rw->count, -RW_LOCK_BIAS) == RW_LOCK_BIAS )
+            return;
+        fetch_add_int(&rw->count, RW_LOCK_BIAS);
+        while ( rw->count != RW_LOCK_BIAS )
+            cpu_relax();
+    }
+}
+
+static inline void rw_write_unlock(rwlock_t *rw)
+{
+    fetch_add_int(&rw->count, RW_LOCK_BIAS);
+}
+
+/*
+ *  Writer-preferring reader-writer spinlock: a writer announces 
+ *  itself in _writers_ before it starts contending, and new 
+ *  readers hold back as long as any writer is announced. Readers
+ *  can be starved instead.
+ *
+ */
+
+typedef struct {
+    rwlock_t rw;
+    volatile int writers;
+} rwlock_wpref_t;
+
+static inline void rw_wpref_lock_init(rwlock_wpref_t *rw)
+{
+    rw_lock_init(&rw->rw);
+    rw->writers = 0;
+}
+
+static inline void rw_wpref_read_lock(rwlock_wpref_t *rw)
+{
+    for (;;) {
+        while ( rw->writers )
+            cpu_relax();
+        if ( fetch_add_int(&rw->rw.count, -1) > 0 )
+            return;
+        fetch_add_int(&rw->rw.count, 1);
+        while ( rw->rw.count <= 0 )
+            cpu_relax();
+    }
+}
+
+static inline void rw_wpref_read_unlock(rwlock_wpref_t *rw)
+{
+    rw_read_unlock(&rw->rw);
+}
+
+static inline void rw_wpref_write_lock(rwlock_wpref_t *rw)
+{
+    fetch_add_int(&rw->writers, 1);
+    rw_write_lock(&rw->rw);
+    fetch_add_int(&rw->writers, -1);
+}
+
+static inline void rw_wpref_write_unlock(rwlock_wpref_t *rw)
+{
+    rw_write_unlock(&rw->rw);
+}
+
+/*
+ *  Distributed ("big-reader") reader-writer lock.
+ *  Every cpu has its own lock on a separate cache line. A reader
+ *  takes only the lock of the cpu it runs on, so readers on 
+ *  different cpus never touch a shared line. A writer takes all
+ *  per-cpu locks in ascending order, which makes writes cost 
+ *  O(ncpus) but keeps reads perfectly local.
+ *
+ *  Callers pass the cpu id they run on (0 .. ncpus-1).
+ *
+ */
+
+#define BRLOCK_MAX_CPUS     128
+
+typedef struct {
+    spinlock_t lock;
+} __attribute__ ((aligned (64))) brlock_slot_t;
+
+typedef struct {
+    brlock_slot_t slot[BRLOCK_MAX_CPUS];
+    int ncpus;
+} brlock_t;
+
+static inline void br_lock_init(brlock_t *br, int ncpus)
+{
+    int i;
+
+    br->ncpus = ncpus;
+    for ( i = 0; i < ncpus; i++ )
+        spin_lock_init(&br->slot[i].lock);
+}
+
+static inline void br_read_lock(brlock_t *br, int cpu)
+{
+    spin_lock_cas_pause(&br->slot[cpu].lock);
+}
+
+static inline void br_read_unlock(brlock_t *br, int cpu)
+{
+    spin_unlock(&br->slot[cpu].lock);
+}
+
+static inline void br_write_lock(brlock_t *br)
+{
+    int i;
+
+    for ( i = 0; i < br->ncpus; i++ )
+        spin_lock_cas_pause(&br->slot[i].lock);
+}
+
+static inline void br_write_unlock(brlock_t *br)
+{
+    int i;
+
+    for ( i = 0; i < br->ncpus; i++ )
+        spin_unlock(&br->slot[i].lock);
+}
+
+
+/*
+ *  CLH queue lock (Craig; Magnusson, Landin and Hagersten).
+ *  A thread swaps its node into _tail_ and spins on the node of
+ *  its predecessor, which it learns implicitly from the swap.
+ *  On release the holder marks its own node as released and 
+ *  takes over its predecessor's node for its next acquisition,
+ *  so nodes are recycled among threads and no thread ever needs
+ *  more than one.
+ *
+ *  Each thread keeps a pointer to the node it will enqueue next,
+ *  which lock/unlock update in place. The lock embeds the initial
+ *  (released) node, and all nodes may migrate between threads,
+ *  so node storage must outlive every thread using the lock.
+ *
+ *  example:
+ *      clh_lock_t l;           //shared
+ *      clh_node_t storage;     //per-thread
+ *      clh_node_t *me = &storage;
+ *      clh_lock_init(&l);
+ *      ...
+ *      clh_lock(&l, &me);
+ *      ...critical section...
+ *      clh_unlock(&l, &me);
+ */
+
+#define CLH_RELEASED    0
+#define CLH_WAITING     1
+#define CLH_ABANDONED   2
+
+typedef struct clh_node_s {
+    volatile unsigned int state;
+    //! predecessor we acquired through (or skip to, if abandoned)
+    struct clh_node_s * volatile pred;
+    //! link in a thread's list of spare nodes (abortable lock only)
+    struct clh_node_s *next_free;
+} __attribute__ ((aligned (64))) clh_node_t;
+
+typedef struct {
+    clh_node_t * volatile tail;
+    clh_node_t dummy;
+} __attribute__ ((aligned (64))) clh_lock_t;
+
+static inline void clh_lock_init(clh_lock_t *l)
+{
+    l->dummy.state = CLH_RELEASED;
+    l->dummy.pred = NULL;
+    l->tail = &l->dummy;
+}
+
+static inline void clh_lock(clh_lock_t *l, clh_node_t **my)
+{
+    clh_node_t *node = *my, *pred;
+
+    node->state = CLH_WAITING;
+    pred = (clh_node_t*)xchg_ptr((void * volatile *)&l->tail, node);
+    node->pred = pred;
+
+    while ( pred->state != CLH_RELEASED )
+        cpu_relax();
+}
+
+/*
+ *  Enqueues only if the tail node is already released. Returns 0
+ *  once the lock is acquired, or LOCK_BUSY without waiting if the
+ *  tail was not released or moved before the cmpxchg.
+ *
+ *  Not strictly non-blocking: the tail node may get recycled and
+ *  re-enqueued, with other waiters queued in between, after the
+ *  check and before the cmpxchg (ABA on _tail_). The cmpxchg then
+ *  succeeds and we are properly queued behind that node, so we
+ *  wait for the whole queue ahead of it (unbounded) instead of
+ *  returning LOCK_BUSY. Callers that must never block should not
+ *  rely on clh_trylock().
+ *
+ */
+static inline int clh_trylock(clh_lock_t *l, clh_node_t **my)
+{
+    clh_node_t *node = *my, *pred = l->tail;
+
+    if ( pred->state != CLH_RELEASED )
+        return LOCK_BUSY;
+
+    node->state = CLH_WAITING;
+    node->pred = pred;
+    if ( cmpxchg_ptr((void * volatile *)&l->tail, pred, node) != pred )
+        return LOCK_BUSY;
+
+    while ( pred->state != CLH_RELEASED )
+        cpu_relax();
+    return 0;
+}
+
+static inline void clh_unlock(clh_lock_t *l, clh_node_t **my)
+{
+    clh_node_t *node = *my, *pred = node->pred;
+
+    node->state = CLH_RELEASED;
+    *my = pred;
+}
+
+
+/*
+ *  Abortable CLH lock.
+ *  A waiter that runs out of its cycle budget leaves the queue:
+ *  if it is the tail it swings _tail_ back to its predecessor,
+ *  otherwise it records its predecessor in its node and marks it
+ *  abandoned. Its successor then skips over the abandoned node 
+ *  to the recorded predecessor and keeps the abandoned node as a
+ *  spare, while the aborting thread takes a spare (or a freshly 
+ *  allocated) node for its next attempt. All lockers of an
+ *  aclh_lock_t must use the aclh_* calls.
+ *
+ *  example:
+ *      aclh_lock_t l;          //shared
+ *      aclh_thread_t me;       //per-thread
+ *      aclh_lock_init(&l);
+ *      aclh_thread_init(&me);
+ *      ...
+ *      if ( aclh_lock_timed(&l, &me, 10000) == 0 ) {
+ *          ...critical section...
+ *          aclh_unlock(&l, &me);
+ *      }
+ *      ...
+ *      aclh_thread_destroy(&l, &me);   //after all threads are done
+ *      aclh_lock_destroy(&l);
+ */
+
+typedef clh_lock_t aclh_lock_t;
+
+typedef struct {
+    //! node to enqueue at the next acquisition
+    clh_node_t *node;
+    //! spare nodes reclaimed from aborted waiters
+    clh_node_t *free;
+} aclh_thread_t;
+
+#define aclh_lock_init  clh_lock_init
+
+static inline clh_node_t* aclh_node_alloc(aclh_thread_t *t)
+{
+    clh_node_t *node = t->free;
+
+    if ( node ) {
+        t->free = node->next_free;
+        return node;
+    }
+    if ( posix_memalign((void**)&node, 64, sizeof(clh_node_t)) )
+        abort();
+    return node;
+}
+
+static inline void aclh_thread_init(aclh_thread_t *t)
+{
+    t->free = NULL;
+    t->node = aclh_node_alloc(t);
+}
+
+static inline int aclh_lock_timed(aclh_lock_t *l, aclh_thread_t *t, 
+                                  unsigned long cycles)
+{
+    clh_node_t *node = t->node, *pred, *skipped;
+    unsigned long start = lock_read_tsc();
+    unsigned int state;
+
+    node->state = CLH_WAITING;
+    pred = (clh_node_t*)xchg_ptr((void * volatile *)&l->tail, node);
+
+    for (;;) {
+        state = pred->state;
+        if ( state == CLH_RELEASED ) {
+            node->pred = pred;
+            return 0;
+        }
+        if ( state == CLH_ABANDONED ) {
+            // Only we can reach the abandoned node; keep it as a spare
+            skipped = pred;
+            pred = pred->pred;
+            skipped->next_free = t->free;
+            t->free = skipped;
+            continue;
+        }
+        if ( lock_read_tsc() - start >= cycles )
+            break;
+        cpu_relax();
+    }
+
+    // Nobody queued behind us: leave as if we had never arrived
+    if ( cmpxchg_ptr((void * volatile *)&l->tail, node, pred) == node )
+        return LOCK_TIMEDOUT;
+
+    // Our successor will skip to _pred_ and keep our node
+    node->pred = pred;
+    node->state = CLH_ABANDONED;
+    t->node = aclh_node_alloc(t);
+
+    return LOCK_TIMEDOUT;
+}
+
+static inline int aclh_lock(aclh_lock_t *l, aclh_thread_t *t)
+{
+    return aclh_lock_timed(l, t, (unsigned long)-1);
+}
+
+static inline int aclh_trylock(aclh_lock_t *l, aclh_thread_t *t)
+{
+    return aclh_lock_timed(l, t, 0) == 0 ? 0 : LOCK_BUSY;
+}
+
+static inline void aclh_unlock(aclh_lock_t *l, aclh_thread_t *t)
+{
+    clh_unlock(l, &t->node);
+}
+
+// Frees the nodes held by a thread; the lock must be quiescent
+static inline void aclh_thread_destroy(aclh_lock_t *l, aclh_thread_t *t)
+{
+    clh_node_t *node;
+
+    if ( t->node != &l->dummy )
+        free(t->node);
+    while ( (node = t->free) ) {
+        t->free = node->next_free;
+        if ( node != &l->dummy )
+            free(node);
+    }
+}
+
+// Frees the node left in the queue; the lock must be quiescent
+static inline void aclh_lock_destroy(aclh_lock_t *l)
+{
+    if ( l->tail != &l->dummy )
+        free(l->tail);
+    l->tail = &l->dummy;
+}
+
+
+/*
+ *  Flat combining (Hendler, Incze, Shavit and Tzafrir, SPAA 2010).
+ *  Instead of handing a lock over once per operation, a thread
+ *  publishes its operation in its own record and tries to become
+ *  the combiner by taking the combiner lock. The combiner applies
+ *  the pending operations of all threads to the (sequential) object
+ *  through the user-supplied _apply_ function, making
+ *  FC_COMBINE_PASSES passes over the records, and hands each result
+ *  back in its record. Everyone else spins on its own record until
+ *  its operation is done or the combiner lock becomes free.
+ *  The object stays in the combiner's cache for the whole batch,
+ *  and the lock changes hands once per batch instead of once per
+ *  operation.
+ *
+ *  Records are static: each thread uses its own id (0 .. nthreads-1).
+ *
+ *  example:
+ *      long apply(void *obj, int op, long arg) { ... }
+ *      fc_t fc;                                //shared
+ *      fc_init(&fc, nthreads, obj, apply);
+ *      ...
+ *      ret = fc_execute(&fc, my_id, op, arg);  //any thread
+ *      ...
+ *      fc_destroy(&fc);
+ */
+
+#define FC_COMBINE_PASSES   2
+
+typedef long (*fc_apply_t)(void *obj, int op, long arg);
+
+typedef struct {
+    //! set by the owner when it posts an operation, cleared by the
+    //! combiner once _ret_ is valid
+    volatile int pending;
+    int op;
+    long arg;
+    long ret;
+} __attribute__ ((aligned (64))) fc_record_t;
+
+typedef struct {
+    spinlock_t lock __attribute__ ((aligned (64)));
+    //! combining sessions and operations applied (written by the combiner)
+    unsigned long sessions;
+    unsigned long applied;
+    void *obj;
+    fc_apply_t apply;
+    int nrecords;
+    fc_record_t *records;
+} fc_t;
+
+static inline void fc_init(fc_t *fc, int nthreads, void *obj, fc_apply_t apply)
+{
+    int i;
+
+    spin_lock_init(&fc->lock);
+    fc->sessions = fc->applied = 0;
+    fc->obj = obj;
+    fc->apply = apply;
+    fc->nrecords = nthreads;
+    if ( posix_memalign((void**)&fc->records, 64,
+                        nthreads * sizeof(fc_record_t)) )
+        abort();
+    for ( i = 0; i < nthreads; i++ )
+        fc->records[i].pending = 0;
+}
+
+static inline void fc_destroy(fc_t *fc)
+{
+    free(fc->records);
+}
+
+// Called with the combiner lock held
+static inline void fc_combine(fc_t *fc)
+{
+    fc_record_t *r;
+    int pass, i;
+
+    for ( pass = 0; pass < FC_COMBINE_PASSES; pass++ ) {
+        for ( i = 0; i < fc->nrecords; i++ ) {
+            r = &fc->records[i];
+            if ( !r->pending )
+                continue;
+            // read _op_ and _arg_ only after _pending_ is seen set
+            __asm__ __volatile__ ("" ::: "memory");
+            r->ret = fc->apply(fc->obj, r->op, r->arg);
+            __asm__ __volatile__ ("" ::: "memory");
+            r->pending = 0;
+            fc->applied++;
+        }
+    }
+    fc->sessions++;
+}
+
+static inline long fc_execute(fc_t *fc, int id, int op, long arg)
+{
+    fc_record_t *r = &fc->records[id];
+
+    r->op = op;
+    r->arg = arg;
+    __asm__ __volatile__ ("" ::: "memory");
+    r->pending = 1;
+
+    for (;;) {
+        // Our record is posted before we take the lock, so the
+        // combiner (possibly us) serves it in its first pass
+        if ( spin_trylock(&fc->lock) == 0 ) {
+            fc_combine(fc);
+            spin_unlock(&fc->lock);
+            return r->ret;
+        }
+        while ( r->pending && fc->lock != SPIN_LOCK_UNLOCKED )
+            cpu_relax();
+        if ( !r->pending ) {
+            // read _ret_ only after _pending_ is seen cleared
+            __asm__ __volatile__ ("" ::: "memory");
+            return r->ret;
+        }
+    }
+}
+
+
+#ifdef LOCK_PROFILE
+#include "lock_profile.h"
+#endif
+
 #endif
@@ -0,0 +1,324 @@
+/*
+ *  Registry and report of the lock contention profiler, see
+ *  lock_profile.h. Linked only into -DLOCK_PROFILE builds.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lock.h"
+
+#ifndef LOCK_PROFILE
+#error "lock_profile.c must be built with -DLOCK_PROFILE"
+#endif
+
+// distinct locks in a report; the rest are counted as dropped
+#define LOCK_PROFILE_MAX_LOCKS  4096
+// characters per report line
+#define LOCK_PROFILE_LINE       256
+
+__thread lock_prof_buf_t *lock_prof_buf;
+
+static lock_prof_buf_t * volatile buffers = NULL;
+static volatile unsigned int installed = 0;
+
+// releases the table of an exiting thread
+static pthread_key_t buf_key;
+static pthread_once_t buf_key_once = PTHREAD_ONCE_INIT;
+
+// report storage is static, so that dumping from a signal never allocates
+static lock_prof_rec_t report[LOCK_PROFILE_MAX_LOCKS];
+static spinlock_t report_lock = SPIN_LOCK_UNLOCKED;
+
+static void dump(int fd, int symbols);
+
+static void dump_at_exit(void)
+{
+    fflush(NULL);
+    lock_profile_dump(STDERR_FILENO);
+}
+
+static void dump_on_signal(int sig)
+{
+    (void)sig;
+    dump(STDERR_FILENO, 0);
+}
+
+static void install_handlers(void)
+{
+    struct sigaction sa;
+    char *out;
+
+    if ( cmpxchg_u32(&installed, 0, 1) != 0 )
+        return;
+
+    atexit(dump_at_exit);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = dump_on_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(LOCK_PROFILE_SIGNAL, &sa, NULL);
+
+    out = getenv("LOCK_PROFILE_OUT");
+    if ( out && !freopen(out, "a", stderr) )
+        perror("LOCK_PROFILE_OUT");
+}
+
+static void release_buf(void *arg)
+{
+    lock_prof_buf_t *b = (lock_prof_buf_t*)arg;
+
+    // locks taken by later destructors get a table of their own
+    lock_prof_buf = NULL;
+    __asm__ __volatile__ ("" ::: "memory");
+    b->in_use = 0;
+}
+
+static void create_key(void)
+{
+    if ( pthread_key_create(&buf_key, release_buf) ) {
+        fprintf(stderr, "%s: Cannot create thread key\n", __FUNCTION__);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Gives the calling thread a record table: one released by an
+ * exited thread if any, otherwise a newly registered one
+ * @return the table
+ */
+lock_prof_buf_t* lock_prof_thread_init(void)
+{
+    lock_prof_buf_t *b, *head;
+
+    install_handlers();
+    pthread_once(&buf_key_once, create_key);
+
+    for ( b = buffers; b; b = b->next )
+        if ( !b->in_use && cmpxchg_u32(&b->in_use, 0, 1) == 0 )
+            break;
+
+    if ( !b ) {
+        b = (lock_prof_buf_t*)calloc(1, sizeof(lock_prof_buf_t));
+        if ( !b ) {
+            fprintf(stderr, "%s: Allocation error\n", __FUNCTION__);
+            exit(EXIT_FAILURE);
+        }
+        b->in_use = 1;
+        do {
+            head = buffers;
+            b->next = head;
+        } while ( cmpxchg_ptr((void * volatile *)&buffers, head, b) != head );
+    }
+
+    pthread_setspecific(buf_key, b);
+    lock_prof_buf = b;
+    return b;
+}
+
+static lock_prof_rec_t* report_rec(void *l, int *nlocks)
+{
+    int i;
+
+    for ( i = 0; i < *nlocks; i++ )
+        if ( report[i].lock == l )
+            return &report[i];
+    if ( *nlocks == LOCK_PROFILE_MAX_LOCKS )
+        return NULL;
+
+    memset(&report[*nlocks], 0, sizeof(lock_prof_rec_t));
+    report[*nlocks].lock = l;
+    return &report[(*nlocks)++];
+}
+
+static void put(int fd, char *line, int len)
+{
+    if ( len > 0 && write(fd, line, len) < 0 )
+        return;
+}
+
+/*
+ *  The report is formatted by hand, since snprintf() is not
+ *  async-signal-safe: the helpers below append to a line of
+ *  LOCK_PROFILE_LINE characters, leaving room for the newline.
+ *
+ */
+
+// Appends _s_, right-aligned to _width_ (left-aligned if negative)
+static int put_col(char *line, int len, const char *s, int width)
+{
+    int n = strlen(s), pad = (width < 0 ? -width : width) - n;
+
+    for ( ; width > 0 && pad > 0 && len < LOCK_PROFILE_LINE - 1; pad-- )
+        line[len++] = ' ';
+    for ( ; *s && len < LOCK_PROFILE_LINE - 1; s++ )
+        line[len++] = *s;
+    for ( ; pad > 0 && len < LOCK_PROFILE_LINE - 1; pad-- )
+        line[len++] = ' ';
+    return len;
+}
+
+// Decimal (or, with _hex_, 0x-prefixed hex) digits of _v_, built
+// backwards from the end of _buf_ (24 chars)
+static char* ulong_str(char *buf, unsigned long v, int hex)
+{
+    char *p = buf + 23;
+
+    *p = '\0';
+    do {
+        *--p = "0123456789abcdef"[hex ? v & 15 : v % 10];
+        v = hex ? v >> 4 : v / 10;
+    } while ( v );
+    if ( hex ) {
+        *--p = 'x';
+        *--p = '0';
+    }
+    return p;
+}
+
+static const int widths[] = {-18, 12, 12, 10, 14, 10, 12, 14, 10, 12, 0};
+#define NCOLS   (sizeof(widths) / sizeof(widths[0]))
+
+// Writes one report line of NCOLS columns
+static void put_row(int fd, const char **cols)
+{
+    char line[LOCK_PROFILE_LINE];
+    int len = 0, i;
+
+    for ( i = 0; i < NCOLS; i++ ) {
+        if ( i )
+            len = put_col(line, len, i == NCOLS - 1 ? "  " : " ", 0);
+        len = put_col(line, len, cols[i], widths[i]);
+    }
+    line[len++] = '\n';
+    put(fd, line, len);
+}
+
+/**
+ * Aggregates the records of all threads by lock and prints them,
+ * sorted by total wait cycles
+ * @param fd output file descriptor
+ * @param symbols resolve lock addresses to symbols (not signal-safe)
+ */
+static void dump(int fd, int symbols)
+{
+    static const char *header[NCOLS] = {
+        "lock", "acquisitions", "contended", "failed",
+        "wait_total", "wait_avg", "wait_max",
+        "hold_total", "hold_avg", "hold_max", "symbol"};
+    lock_prof_buf_t *b;
+    lock_prof_rec_t *r, *a, tmp;
+    unsigned long dropped = 0;
+    int ntables = 0, nlocks = 0, len, i, j;
+    char line[LOCK_PROFILE_LINE], num[NCOLS][24];
+    const char *cols[NCOLS];
+    Dl_info info;
+
+    // another dump (e.g. a signal during the exit dump) is in progress;
+    // the parentheses keep report_lock itself out of the profile
+    if ( (spin_trylock)(&report_lock) )
+        return;
+
+    for ( b = buffers; b; b = b->next, ntables++ ) {
+        dropped += b->dropped;
+        for ( i = 0; i < LOCK_PROFILE_SLOTS; i++ ) {
+            r = &b->rec[i];
+            if ( !r->lock || (!r->acquisitions && !r->failed) )
+                continue;
+            a = report_rec(r->lock, &nlocks);
+            if ( !a ) {
+                dropped += r->acquisitions;
+                continue;
+            }
+            a->acquisitions += r->acquisitions;
+            a->contended += r->contended;
+            a->failed += r->failed;
+            a->wait_total += r->wait_total;
+            a->hold_total += r->hold_total;
+            if ( r->wait_max > a->wait_max )
+                a->wait_max = r->wait_max;
+            if ( r->hold_max > a->hold_max )
+                a->hold_max = r->hold_max;
+        }
+    }
+
+    for ( i = 1; i < nlocks; i++ ) {
+        tmp = report[i];
+        for ( j = i; j > 0 && report[j-1].wait_total < tmp.wait_total; j-- )
+            report[j] = report[j-1];
+        report[j] = tmp;
+    }
+
+    len = put_col(line, 0, "Lock profile: ", 0);
+    len = put_col(line, len, ulong_str(num[0], nlocks, 0), 0);
+    len = put_col(line, len, " locks, ", 0);
+    len = put_col(line, len, ulong_str(num[0], ntables, 0), 0);
+    len = put_col(line, len, " tables, ", 0);
+    len = put_col(line, len, ulong_str(num[0], dropped, 0), 0);
+    len = put_col(line, len, " dropped", 0);
+    line[len++] = '\n';
+    put(fd, line, len);
+    put_row(fd, header);
+
+    for ( i = 0; i < nlocks; i++ ) {
+        a = &report[i];
+        // resolves static locks (link with -rdynamic for executables)
+        if ( !symbols || !dladdr(a->lock, &info) || !info.dli_sname )
+            info.dli_sname = "";
+        cols[0] = ulong_str(num[0], (unsigned long)a->lock, 1);
+        cols[1] = ulong_str(num[1], a->acquisitions, 0);
+        cols[2] = ulong_str(num[2], a->contended, 0);
+        cols[3] = ulong_str(num[3], a->failed, 0);
+        cols[4] = ulong_str(num[4], a->wait_total, 0);
+        cols[5] = ulong_str(num[5], a->acquisitions ? 
+                                    a->wait_total / a->acquisitions : 0, 0);
+        cols[6] = ulong_str(num[6], a->wait_max, 0);
+        cols[7] = ulong_str(num[7], a->hold_total, 0);
+        cols[8] = ulong_str(num[8], a->acquisitions ? 
+                                    a->hold_total / a->acquisitions : 0, 0);
+        cols[9] = ulong_str(num[9], a->hold_max, 0);
+        cols[10] = info.dli_sname;
+        put_row(fd, cols);
+    }
+
+    (spin_unlock)(&report_lock);
+}
+
+/**
+ * Prints the profile with lock symbols; not async-signal-safe
+ * @param fd output file descriptor
+ */
+void lock_profile_dump(int fd)
+{
+    dump(fd, 1);
+}
+
+/**
+ * Clears the records of all threads, e.g. after a warm-up phase;
+ * locks operated on concurrently may keep a few stale counts
+ */
+void lock_profile_reset(void)
+{
+    lock_prof_buf_t *b;
+    int i;
+
+    for ( b = buffers; b; b = b->next ) {
+        b->dropped = 0;
+        for ( i = 0; i < LOCK_PROFILE_SLOTS; i++ ) {
+            b->rec[i].acquisitions = 0;
+            b->rec[i].contended = 0;
+            b->rec[i].failed = 0;
+            b->rec[i].wait_total = 0;
+            b->rec[i].wait_max = 0;
+            b->rec[i].hold_total = 0;
+            b->rec[i].hold_max = 0;
+        }
+    }
+}
@@ -0,0 +1,248 @@
+#ifndef LOCK_PROFILE_H_
+#define LOCK_PROFILE_H_
+
+/*
+ *  Lock contention profiler (build with -DLOCK_PROFILE and link
+ *  lock_profile.o; without it lock.h does not include this file
+ *  and nothing changes).
+ *
+ *  Every lock / trylock / unlock entry point of lock.h is wrapped
+ *  by a macro of the same name, so callers need no changes. Per
+ *  lock instance (i.e. per lock address) the wrappers record:
+ *   - acquisitions, and failed trylock / timed attempts
+ *   - contended acquisitions: the lock was observed taken (or
+ *     queued on) on arrival
+ *   - total and max wait cycles, from arrival until acquisition
+ *   - total and max hold cycles, from acquisition until release
+ *
+ *  Records live in a per-thread open-addressing table, so the hot
+ *  path touches only thread-local memory. Tables are registered in
+ *  a global list on first use and never freed; when a thread exits
+ *  its table, records included, is handed to the next thread that
+ *  starts profiling. So the profile survives thread exit, and the
+ *  list only grows up to the peak number of live threads. lock_profile_dump() aggregates all tables
+ *  by lock address and prints them sorted by total wait; it runs
+ *  at exit and on LOCK_PROFILE_SIGNAL (e.g. kill -USR2 <pid>), to
+ *  stderr or to the file named by $LOCK_PROFILE_OUT.
+ *  The dump reads the tables while their owners keep updating
+ *  them, so a snapshot taken on a signal may be slightly torn.
+ *  The dump on the signal is async-signal-safe and so prints raw
+ *  lock addresses; symbols are resolved (with dladdr()) only by the
+ *  exit dump and by direct calls of lock_profile_dump().
+ *
+ *  Locks nested inside other primitives (e.g. the per-cpu spinlocks
+ *  of brlock_t, the ticket locks of cohort_lock_t) are profiled
+ *  only as part of the outer lock.
+ *
+ */
+
+#include <signal.h>
+
+#ifndef LOCK_PROFILE_SLOTS
+#define LOCK_PROFILE_SLOTS      256     // per thread, power of 2
+#endif
+
+#ifndef LOCK_PROFILE_SIGNAL
+#define LOCK_PROFILE_SIGNAL     SIGUSR2
+#endif
+
+typedef struct {
+    void *lock;
+    unsigned long acquisitions;
+    unsigned long contended;
+    unsigned long failed;
+    unsigned long wait_total;
+    unsigned long wait_max;
+    unsigned long hold_total;
+    unsigned long hold_max;
+    //! timestamp of the current acquisition (owner thread only)
+    unsigned long hold_start;
+} lock_prof_rec_t;
+
+typedef struct lock_prof_buf_s {
+    lock_prof_rec_t rec[LOCK_PROFILE_SLOTS];
+    //! lock operations lost because the table was full
+    unsigned long dropped;
+    //! owned by a live thread; free tables are reused by new threads
+    volatile unsigned int in_use;
+    struct lock_prof_buf_s *next;
+} lock_prof_buf_t;
+
+extern __thread lock_prof_buf_t *lock_prof_buf;
+
+extern lock_prof_buf_t* lock_prof_thread_init(void);
+extern void lock_profile_dump(int fd);
+extern void lock_profile_reset(void);
+
+static inline lock_prof_rec_t* lock_prof_rec(void *l)
+{
+    lock_prof_buf_t *b = lock_prof_buf;
+    unsigned long h;
+    int i;
+
+    if ( !b )
+        b = lock_prof_thread_init();
+
+    // locks are at least 4 bytes apart, most a cache line apart
+    h = ((unsigned long)l >> 2) * 0x9e3779b97f4a7c15UL;
+    h >>= 64 - __builtin_ctz(LOCK_PROFILE_SLOTS);
+    for ( i = 0; i < LOCK_PROFILE_SLOTS; i++ ) {
+        lock_prof_rec_t *r = &b->rec[(h + i) & (LOCK_PROFILE_SLOTS - 1)];
+        if ( r->lock == l )
+            return r;
+        if ( r->lock == NULL ) {
+            r->lock = l;
+            return r;
+        }
+    }
+
+    b->dropped++;
+    return NULL;
+}
+
+static inline void lock_prof_acquired(void *l, int contended, unsigned long t0)
+{
+    unsigned long now = lock_read_tsc(), wait = now - t0;
+    lock_prof_rec_t *r = lock_prof_rec(l);
+
+    if ( !r )
+        return;
+    r->acquisitions++;
+    r->contended += contended;
+    r->wait_total += wait;
+    if ( wait > r->wait_max )
+        r->wait_max = wait;
+    r->hold_start = now;
+}
+
+static inline void lock_prof_failed(void *l)
+{
+    lock_prof_rec_t *r = lock_prof_rec(l);
+
+    if ( r )
+        r->failed++;
+}
+
+static inline void lock_prof_released(void *l)
+{
+    unsigned long hold;
+    lock_prof_rec_t *r = lock_prof_rec(l);
+
+    if ( !r || !r->hold_start )
+        return;
+    hold = lock_read_tsc() - r->hold_start;
+    r->hold_start = 0;
+    r->hold_total += hold;
+    if ( hold > r->hold_max )
+        r->hold_max = hold;
+}
+
+/*
+ *  _busy_ is a racy peek at the lock state, evaluated on arrival;
+ *  it only classifies the acquisition and never affects it.
+ *
+ */
+#define LOCK_PROF_LOCK(l, busy, call) \
+    do { \
+        unsigned long __lp_t0 = lock_read_tsc(); \
+        int __lp_busy = (busy); \
+        call; \
+        lock_prof_acquired((void*)(l), __lp_busy, __lp_t0); \
+    } while (0)
+
+// for entry points that return 0 on acquisition
+#define LOCK_PROF_TRY(l, busy, call) \
+    ({ \
+        unsigned long __lp_t0 = lock_read_tsc(); \
+        int __lp_busy = (busy); \
+        int __lp_ret = (call); \
+        if ( __lp_ret == 0 ) \
+            lock_prof_acquired((void*)(l), __lp_busy, __lp_t0); \
+        else \
+            lock_prof_failed((void*)(l)); \
+        __lp_ret; \
+    })
+
+#define LOCK_PROF_UNLOCK(l, call) \
+    do { \
+        lock_prof_released((void*)(l)); \
+        call; \
+    } while (0)
+
+/*
+ *  A function-like macro is not expanded again inside its own
+ *  expansion, so the _call_ arguments below reach the functions
+ *  of lock.h.
+ *
+ */
+#define LOCK_PROF_SPIN_BUSY(s)      (*(s) != SPIN_LOCK_UNLOCKED)
+
+#define spin_lock(s)                LOCK_PROF_LOCK(s, LOCK_PROF_SPIN_BUSY(s), spin_lock(s))
+#define spin_lock_aligned(s)        LOCK_PROF_LOCK(s, LOCK_PROF_SPIN_BUSY(s), spin_lock_aligned(s))
+#define spin_lock_aligned_pause(s)  LOCK_PROF_LOCK(s, LOCK_PROF_SPIN_BUSY(s), spin_lock_aligned_pause(s))
+#define spin_lock_cas(s)            LOCK_PROF_LOCK(s, LOCK_PROF_SPIN_BUSY(s), spin_lock_cas(s))
+#define spin_lock_cas_pause(s)      LOCK_PROF_LOCK(s, LOCK_PROF_SPIN_BUSY(s), spin_lock_cas_pause(s))
+#define spin_lock_yield(s)          LOCK_PROF_LOCK(s, LOCK_PROF_SPIN_BUSY(s), spin_lock_yield(s))
+#define spin_trylock(s)             LOCK_PROF_TRY(s, LOCK_PROF_SPIN_BUSY(s), spin_trylock(s))
+#define spin_lock_timed(s, c)       LOCK_PROF_TRY(s, LOCK_PROF_SPIN_BUSY(s), spin_lock_timed(s, c))
+#define spin_unlock(s)              LOCK_PROF_UNLOCK(s, spin_unlock(s))
+
+#define backoff_lock(bl)            LOCK_PROF_LOCK(bl, LOCK_PROF_SPIN_BUSY(&(bl)->lock), backoff_lock(bl))
+#define backoff_trylock(bl)         LOCK_PROF_TRY(bl, LOCK_PROF_SPIN_BUSY(&(bl)->lock), backoff_trylock(bl))
+#define backoff_unlock(bl)          LOCK_PROF_UNLOCK(bl, backoff_unlock(bl))
+
+#define LOCK_PROF_TICKET_BUSY(tl)   ((tl)->next != (tl)->owner)
+
+#define ticket_lock(tl)             LOCK_PROF_LOCK(tl, LOCK_PROF_TICKET_BUSY(tl), ticket_lock(tl))
+#define ticket_lock_backoff(tl)     LOCK_PROF_LOCK(tl, LOCK_PROF_TICKET_BUSY(tl), ticket_lock_backoff(tl))
+#define ticket_lock_yield(tl)       LOCK_PROF_LOCK(tl, LOCK_PROF_TICKET_BUSY(tl), ticket_lock_yield(tl))
+#define ticket_trylock(tl)          LOCK_PROF_TRY(tl, LOCK_PROF_TICKET_BUSY(tl), ticket_trylock(tl))
+#define ticket_unlock(tl)           LOCK_PROF_UNLOCK(tl, ticket_unlock(tl))
+
+#define mcs_lock(l, n)              LOCK_PROF_LOCK(l, (l)->tail != NULL, mcs_lock(l, n))
+#define mcs_lock_yield(l, n)        LOCK_PROF_LOCK(l, (l)->tail != NULL, mcs_lock_yield(l, n))
+#define mcs_trylock(l, n)           LOCK_PROF_TRY(l, (l)->tail != NULL, mcs_trylock(l, n))
+#define mcs_unlock(l, n)            LOCK_PROF_UNLOCK(l, mcs_unlock(l, n))
+#define mcs_unlock_yield(l, n)      LOCK_PROF_UNLOCK(l, mcs_unlock_yield(l, n))
+
+#define cohort_lock(cl, pkg) \
+    LOCK_PROF_LOCK(cl, LOCK_PROF_TICKET_BUSY(&(cl)->local[pkg].lock) || \
+                       (!(cl)->local[pkg].owns_global && \
+                        LOCK_PROF_TICKET_BUSY(&(cl)->global)), \
+                   cohort_lock(cl, pkg))
+#define cohort_unlock(cl, pkg)      LOCK_PROF_UNLOCK(cl, cohort_unlock(cl, pkg))
+
+#define futex_lock(fl)              LOCK_PROF_LOCK(fl, (fl)->state != 0, futex_lock(fl))
+#define futex_trylock(fl)           LOCK_PROF_TRY(fl, (fl)->state != 0, futex_trylock(fl))
+#define futex_unlock(fl)            LOCK_PROF_UNLOCK(fl, futex_unlock(fl))
+
+#define rw_read_lock(rw)            LOCK_PROF_LOCK(rw, (rw)->count <= 0, rw_read_lock(rw))
+#define rw_read_unlock(rw)          LOCK_PROF_UNLOCK(rw, rw_read_unlock(rw))
+#define rw_write_lock(rw)           LOCK_PROF_LOCK(rw, (rw)->count != RW_LOCK_BIAS, rw_write_lock(rw))
+#define rw_write_unlock(rw)         LOCK_PROF_UNLOCK(rw, rw_write_unlock(rw))
+
+#define rw_wpref_read_lock(rw) \
+    LOCK_PROF_LOCK(rw, (rw)->writers || (rw)->rw.count <= 0, rw_wpref_read_lock(rw))
+#define rw_wpref_read_unlock(rw)    LOCK_PROF_UNLOCK(rw, rw_wpref_read_unlock(rw))
+#define rw_wpref_write_lock(rw) \
+    LOCK_PROF_LOCK(rw, (rw)->rw.count != RW_LOCK_BIAS, rw_wpref_write_lock(rw))
+#define rw_wpref_write_unlock(rw)   LOCK_PROF_UNLOCK(rw, rw_wpref_write_unlock(rw))
+
+#define br_read_lock(br, cpu) \
+    LOCK_PROF_LOCK(br, LOCK_PROF_SPIN_BUSY(&(br)->slot[cpu].lock), br_read_lock(br, cpu))
+#define br_read_unlock(br, cpu)     LOCK_PROF_UNLOCK(br, br_read_unlock(br, cpu))
+#define br_write_lock(br)           LOCK_PROF_LOCK(br, LOCK_PROF_SPIN_BUSY(&(br)->slot[0].lock), br_write_lock(br))
+#define br_write_unlock(br)         LOCK_PROF_UNLOCK(br, br_write_unlock(br))
+
+#define LOCK_PROF_CLH_BUSY(l)       ((l)->tail->state != CLH_RELEASED)
+
+#define clh_lock(l, my)             LOCK_PROF_LOCK(l, LOCK_PROF_CLH_BUSY(l), clh_lock(l, my))
+#define clh_trylock(l, my)          LOCK_PROF_TRY(l, LOCK_PROF_CLH_BUSY(l), clh_trylock(l, my))
+#define clh_unlock(l, my)           LOCK_PROF_UNLOCK(l, clh_unlock(l, my))
+
+#define aclh_lock(l, t)             LOCK_PROF_TRY(l, LOCK_PROF_CLH_BUSY(l), aclh_lock(l, t))
+#define aclh_lock_timed(l, t, c)    LOCK_PROF_TRY(l, LOCK_PROF_CLH_BUSY(l), aclh_lock_timed(l, t, c))
+#define aclh_trylock(l, t)          LOCK_PROF_TRY(l, LOCK_PROF_CLH_BUSY(l), aclh_trylock(l, t))
+#define aclh_unlock(l, t)           LOCK_PROF_UNLOCK(l, aclh_unlock(l, t))
+
+#endif
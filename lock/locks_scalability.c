@@ -5,23 +5,109 @@
 
 #define _GNU_SOURCE
 
+#include <limits.h>
 #include <pthread.h>
 #include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include "lock.h"
+#include "delegation.h"
+#include "lat_hist.h"
+#include "bench/stats.h"
+#include "bench/placement.h"
+#include "bench/perf_counters.h"
 #include "util/tsc_x86_64.h"
 #include "util/processor_map.h"
 #include "util/util.h"
 
 unsigned long iters;
+// cycle budget of the *_TIMED ops
+unsigned long timeout_cycles = 10000;
+// consecutive intra-package handoffs of the cohort lock
+unsigned int cohort_handoffs = COHORT_DEFAULT_HANDOFFS;
+
+// min:max pause settings swept by the *_BACKOFF ops
+#define MAX_BACKOFF_SETTINGS 16
+struct {
+    unsigned int min, max;
+} backoffs[MAX_BACKOFF_SETTINGS] = { {.min = 4, .max = 1024} };
+int nbackoffs = 0;
+
+// critical section length and non-critical think time, in cycles
+unsigned long cs_cycles = 0;
+unsigned long think_cycles = 0;
+// shared cache lines read / written inside the critical section
+int lines_read = 0;
+int lines_written = 0;
+
+typedef struct {
+    volatile unsigned long word;
+} __attribute__ ((aligned (64))) cache_line_t;
+
+cache_line_t *shared_lines;
+
+// protected data structure (-S): with one, each critical section
+// applies a single operation to it instead of the synthetic workload
+typedef enum {
+    CS_SYNTHETIC = 0,
+    CS_COUNTER,
+    CS_PQUEUE
+} cs_struct_t;
+
+cs_struct_t cs_struct = CS_SYNTHETIC;
+char *cs_struct_names[] = {"synthetic", "counter", "pq"};
+
+// operations applied in the critical section
+#define CS_OP_WORK          0
+#define CS_OP_INCREMENT     1
+#define CS_OP_PQ_INSERT     2
+#define CS_OP_PQ_DELETE_MIN 3
+
+cache_line_t shared_counter;
+
+// sequential binary min-heap; each run starts with PQ_INITIAL_SIZE
+// keys and every thread alternates insert and delete-min
+#define PQ_INITIAL_SIZE     1024
+#define PQ_KEY_RANGE        (1UL << 20)
+
+typedef struct {
+    long *keys;
+    unsigned long size;
+} pqueue_t;
+
+pqueue_t pq;
+
+// record per-acquisition wait times into per-thread histograms
+int record_latency = 0;
+
+// time-bounded mode: run each op for _duration_ms_ instead of a 
+// fixed number of iterations, and report fairness
+unsigned long duration_ms = 0;
+volatile int stop __attribute__ ((aligned (64)));
+// id of the thread that last entered the critical section
+volatile int last_owner __attribute__ ((aligned (64)));
+
+// measured runs per configuration, and discarded warm-up runs before them
+int reps = 1;
+int warmups = 0;
 pthread_barrier_t bar;
 tsctimer_t tim;
 
 spinlock_t lock;
+ticketlock_t tlock;
+mcs_lock_t mcslock;
+clh_lock_t clhlock;
+aclh_lock_t aclhlock;
+cohort_lock_t cohortlock;
+futexlock_t futexlock;
+backoff_lock_t backofflock;
 pthread_mutex_t mutex;
+fc_t fc;
+deleg_t deleg;
 
 typedef enum {
     NO_OP = 0, 
@@ -30,16 +116,41 @@ typedef enum {
     SPIN_LOCK_ALIGNED_PAUSED,
     SPIN_LOCK_TTAS,
     SPIN_LOCK_TTAS_PAUSED,
+    SPIN_LOCK_TTAS_BACKOFF,
+    SPIN_LOCK_TTAS_BACKOFF_JITTER,
+    SPIN_LOCK_TTAS_YIELD,
+    TICKET_LOCK,
+    TICKET_LOCK_PROP_BACKOFF,
+    TICKET_LOCK_YIELD,
+    MCS_LOCK,
+    MCS_LOCK_YIELD,
+    CLH_LOCK,
+    SPIN_LOCK_TTAS_TIMED,
+    ACLH_LOCK_TIMED,
+    COHORT_LOCK,
+    FUTEX_LOCK,
     PTHREAD_MUTEX,
+    FLAT_COMBINING,
+    DELEGATION,
     DELAY
 } opcode_t;
 
 typedef struct {
     opcode_t code;
     char *name;
+    //! acquisitions may time out: report success rate and latency
+    int timed;
+    //! waiters sleep or yield: also run with more threads than cpus
+    int blocking;
+    //! run once per backoff setting
+    int backoff;
+    unsigned int min_backoff, max_backoff;
 } op_desc_t;
 
 #define INIT_OP(o) {.code = o, .name = #o}
+#define INIT_TIMED_OP(o) {.code = o, .name = #o, .timed = 1}
+#define INIT_BLOCKING_OP(o) {.code = o, .name = #o, .blocking = 1}
+#define INIT_BACKOFF_OP(o) {.code = o, .name = #o, .backoff = 1}
 
 op_desc_t ops[] = {
     /*INIT_OP(SPIN_LOCK),*/
@@ -47,14 +158,53 @@ op_desc_t ops[] = {
     INIT_OP(SPIN_LOCK_ALIGNED_PAUSED),
     INIT_OP(SPIN_LOCK_TTAS),
     INIT_OP(SPIN_LOCK_TTAS_PAUSED),
-    INIT_OP(PTHREAD_MUTEX),
+    INIT_BACKOFF_OP(SPIN_LOCK_TTAS_BACKOFF),
+    INIT_BACKOFF_OP(SPIN_LOCK_TTAS_BACKOFF_JITTER),
+    INIT_BLOCKING_OP(SPIN_LOCK_TTAS_YIELD),
+    INIT_OP(TICKET_LOCK),
+    INIT_OP(TICKET_LOCK_PROP_BACKOFF),
+    INIT_BLOCKING_OP(TICKET_LOCK_YIELD),
+    INIT_OP(MCS_LOCK),
+    INIT_BLOCKING_OP(MCS_LOCK_YIELD),
+    INIT_OP(CLH_LOCK),
+    INIT_TIMED_OP(SPIN_LOCK_TTAS_TIMED),
+    INIT_TIMED_OP(ACLH_LOCK_TIMED),
+    INIT_OP(COHORT_LOCK),
+    INIT_BLOCKING_OP(FUTEX_LOCK),
+    INIT_BLOCKING_OP(PTHREAD_MUTEX),
+    INIT_OP(FLAT_COMBINING),
+    INIT_OP(DELEGATION),
     INIT_OP(DELAY),
     INIT_OP(NO_OP)
 };
 
 typedef struct {
     int id;
+    //! package the thread is pinned to
+    int package;
     op_desc_t *od;
+    mcs_node_t *qnode;
+    clh_node_t *clhnode;
+    aclh_thread_t aclh;
+    //! successful acquisitions and cycles spent in them (timed ops)
+    unsigned long acquired;
+    unsigned long acq_cycles;
+    //! acquisition latencies (-H)
+    lat_hist_t *hist;
+    //! iterations completed
+    unsigned long ops;
+    //! track consecutive acquisitions (time-bounded mode)
+    int track_owner;
+    unsigned long streak;
+    unsigned long max_streak;
+    //! hardware counters of the timed region (-e)
+    perf_counters_t perf;
+    //! key generator and next operation (-S pq)
+    unsigned long seed;
+    int pq_insert;
+    //! critical section shipped to the delegation server
+    int deleg_op;
+    long deleg_arg;
 } targs_t;
 
 #define fp_work() {\
@@ -83,171 +233,781 @@ typedef struct {
 
 #define delay() fp_work()
 
+static inline unsigned long next_rand(unsigned long *seed)
+{
+    // xorshift64
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    return *seed;
+}
+
+static inline void pq_insert(pqueue_t *q, long key)
+{
+    unsigned long i = q->size++, parent;
+
+    while ( i > 0 ) {
+        parent = (i - 1) / 2;
+        if ( q->keys[parent] <= key )
+            break;
+        q->keys[i] = q->keys[parent];
+        i = parent;
+    }
+    q->keys[i] = key;
+}
+
+// Returns the smallest key, or -1 if the queue is empty
+static inline long pq_delete_min(pqueue_t *q)
+{
+    unsigned long i = 0, child;
+    long min, last;
+
+    if ( q->size == 0 )
+        return -1;
+    min = q->keys[0];
+    last = q->keys[--q->size];
+    while ( (child = 2 * i + 1) < q->size ) {
+        if ( child + 1 < q->size && q->keys[child + 1] < q->keys[child] )
+            child++;
+        if ( last <= q->keys[child] )
+            break;
+        q->keys[i] = q->keys[child];
+        i = child;
+    }
+    q->keys[i] = last;
+
+    return min;
+}
+
+/*
+ * Workload model: the critical section runs for _cs_cycles_ (or
+ * just delay() if 0) and then reads _lines_read_ and writes 
+ * _lines_written_ distinct shared cache lines; between critical 
+ * sections each thread thinks for _think_cycles_.
+ * With -S, it applies _op_ to the protected structure instead.
+ */ 
+static inline long critical_section(int op, long arg)
+{
+    unsigned long sum = 0;
+    int l;
+
+    switch ( op ) {
+        case CS_OP_INCREMENT:
+            return shared_counter.word += arg;
+        case CS_OP_PQ_INSERT:
+            pq_insert(&pq, arg);
+            return 0;
+        case CS_OP_PQ_DELETE_MIN:
+            return pq_delete_min(&pq);
+        default:
+            break;
+    }
+
+    if ( cs_cycles ) 
+        spin_for_cycles(cs_cycles);
+    else
+        delay();
+
+    for ( l = 0; l < lines_read; l++ )
+        sum += shared_lines[l].word;
+    for ( l = lines_read; l < lines_read + lines_written; l++ )
+        shared_lines[l].word++;
+    __asm__ __volatile__ ("" :: "r" (sum));
+
+    return 0;
+}
+
+/*
+ * Picks the next critical section operation of a thread; called 
+ * before acquiring, so that key generation stays outside
+ */ 
+static inline int next_op(targs_t *ta, long *arg)
+{
+    // DELAY holds no lock, so it must not touch the shared structure
+    if ( ta->od->code == DELAY ) {
+        *arg = 0;
+        return CS_OP_WORK;
+    }
+
+    switch ( cs_struct ) {
+        case CS_COUNTER:
+            *arg = 1;
+            return CS_OP_INCREMENT;
+        case CS_PQUEUE:
+            ta->pq_insert = !ta->pq_insert;
+            *arg = next_rand(&ta->seed) % PQ_KEY_RANGE;
+            return ta->pq_insert ? CS_OP_PQ_INSERT : CS_OP_PQ_DELETE_MIN;
+        default:
+            *arg = 0;
+            return CS_OP_WORK;
+    }
+}
+
+// Applies the operations of the FLAT_COMBINING op
+long fc_apply_cs(void *obj, int op, long arg)
+{
+    return critical_section(op, arg);
+}
+
+// Closure of the DELEGATION op, run by the server
+long deleg_cs(void *arg)
+{
+    targs_t *ta = (targs_t*)arg;
+
+    return critical_section(ta->deleg_op, ta->deleg_arg);
+}
+
+static inline void think(void)
+{
+    if ( think_cycles ) 
+        spin_for_cycles(think_cycles);
+}
+
+/*
+ * Called right after an acquisition: counts how many times in a
+ * row the same thread got the lock
+ */ 
+static inline void track_owner(targs_t *ta)
+{
+    if ( !ta->track_owner )
+        return;
+
+    if ( last_owner == ta->id ) {
+        ta->streak++;
+    } else {
+        last_owner = ta->id;
+        ta->streak = 1;
+    }
+    if ( ta->streak > ta->max_streak )
+        ta->max_streak = ta->streak;
+}
+
+#define LOCK_LOOP(acquire, release)                         \
+    for ( ; i < iters && !stop; i++ ) {                     \
+        cs_op = next_op(ta, &cs_arg);                       \
+        if ( record_latency ) {                             \
+            start = lock_read_tsc();                        \
+            acquire;                                        \
+            lat_hist_add(ta->hist, lock_read_tsc() - start);\
+        } else {                                            \
+            acquire;                                        \
+        }                                                   \
+        track_owner(ta);                                    \
+        critical_section(cs_op, cs_arg);                    \
+        release;                                            \
+        think();                                            \
+    }
+
 void* thread_fn(void *args)
 {
-    unsigned long i = 0;
+    unsigned long i = 0, start, lat;
     targs_t *ta = (targs_t*)args;
+    int cs_op;
+    long cs_arg;
+
+    perf_counters_open(&ta->perf);
 
     pthread_barrier_wait(&bar);
     if ( ta->id == 0 ) timer_start(&tim);
+    perf_counters_start(&ta->perf);
 
     switch ( ta->od->code ) {
       
         case SPIN_LOCK:
-            while ( i++ < iters ) {
-                spin_lock(&lock);
-                delay();
-                spin_unlock(&lock);
-            }
+            LOCK_LOOP(spin_lock(&lock), spin_unlock(&lock));
             break;
             
         case SPIN_LOCK_ALIGNED:
-            while ( i++ < iters ) {
-                spin_lock_aligned(&lock);
-                delay();
-                spin_unlock(&lock);
-            }
+            LOCK_LOOP(spin_lock_aligned(&lock), spin_unlock(&lock));
             break;
             
         case SPIN_LOCK_ALIGNED_PAUSED:
-            while ( i++ < iters ) {
-                spin_lock_aligned_pause(&lock);
-                delay();
-                spin_unlock(&lock);
-            }
+            LOCK_LOOP(spin_lock_aligned_pause(&lock), spin_unlock(&lock));
             break;
         
         case SPIN_LOCK_TTAS:
-            while ( i++ < iters ) {
-                spin_lock_cas(&lock);
-                delay();
-                spin_unlock(&lock);
-            }
+            LOCK_LOOP(spin_lock_cas(&lock), spin_unlock(&lock));
             break;
           
         case SPIN_LOCK_TTAS_PAUSED:
-            while ( i++ < iters ) {
-                spin_lock_cas_pause(&lock);
-                delay();
+            LOCK_LOOP(spin_lock_cas_pause(&lock), spin_unlock(&lock));
+            break;
+
+        case SPIN_LOCK_TTAS_BACKOFF:
+        case SPIN_LOCK_TTAS_BACKOFF_JITTER:
+            LOCK_LOOP(backoff_lock(&backofflock), backoff_unlock(&backofflock));
+            break;
+
+        case SPIN_LOCK_TTAS_YIELD:
+            LOCK_LOOP(spin_lock_yield(&lock), spin_unlock(&lock));
+            break;
+
+        case TICKET_LOCK:
+            LOCK_LOOP(ticket_lock(&tlock), ticket_unlock(&tlock));
+            break;
+
+        case TICKET_LOCK_PROP_BACKOFF:
+            LOCK_LOOP(ticket_lock_backoff(&tlock), ticket_unlock(&tlock));
+            break;
+
+        case TICKET_LOCK_YIELD:
+            LOCK_LOOP(ticket_lock_yield(&tlock), ticket_unlock(&tlock));
+            break;
+
+        case MCS_LOCK:
+            LOCK_LOOP(mcs_lock(&mcslock, ta->qnode), 
+                      mcs_unlock(&mcslock, ta->qnode));
+            break;
+
+        case MCS_LOCK_YIELD:
+            LOCK_LOOP(mcs_lock_yield(&mcslock, ta->qnode), 
+                      mcs_unlock_yield(&mcslock, ta->qnode));
+            break;
+
+        case CLH_LOCK:
+            LOCK_LOOP(clh_lock(&clhlock, &ta->clhnode), 
+                      clh_unlock(&clhlock, &ta->clhnode));
+            break;
+
+        case SPIN_LOCK_TTAS_TIMED:
+            for ( ; i < iters && !stop; i++ ) {
+                start = lock_read_tsc();
+                if ( spin_lock_timed(&lock, timeout_cycles) ) {
+                    think();
+                    continue;
+                }
+                lat = lock_read_tsc() - start;
+                ta->acq_cycles += lat;
+                ta->acquired++;
+                if ( record_latency ) 
+                    lat_hist_add(ta->hist, lat);
+                track_owner(ta);
+                // only acquisitions draw operations, so that the
+                // queue does not grow with timeouts
+                cs_op = next_op(ta, &cs_arg);
+                critical_section(cs_op, cs_arg);
                 spin_unlock(&lock);
+                think();
+            }
+            break;
+
+        case ACLH_LOCK_TIMED:
+            for ( ; i < iters && !stop; i++ ) {
+                start = lock_read_tsc();
+                if ( aclh_lock_timed(&aclhlock, &ta->aclh, timeout_cycles) ) {
+                    think();
+                    continue;
+                }
+                lat = lock_read_tsc() - start;
+                ta->acq_cycles += lat;
+                ta->acquired++;
+                if ( record_latency ) 
+                    lat_hist_add(ta->hist, lat);
+                track_owner(ta);
+                cs_op = next_op(ta, &cs_arg);
+                critical_section(cs_op, cs_arg);
+                aclh_unlock(&aclhlock, &ta->aclh);
+                think();
             }
             break;
 
+        case COHORT_LOCK:
+            LOCK_LOOP(cohort_lock(&cohortlock, ta->package), 
+                      cohort_unlock(&cohortlock, ta->package));
+            break;
+
+        case FUTEX_LOCK:
+            LOCK_LOOP(futex_lock(&futexlock), futex_unlock(&futexlock));
+            break;
+
         case PTHREAD_MUTEX:
-            while ( i++ < iters ) {
-                pthread_mutex_lock(&mutex);
-                delay();
-                pthread_mutex_unlock(&mutex);
+            LOCK_LOOP(pthread_mutex_lock(&mutex), pthread_mutex_unlock(&mutex));
+            break;
+
+        // one combiner applies the critical sections of all waiters
+        case FLAT_COMBINING:
+            for ( ; i < iters && !stop; i++ ) {
+                cs_op = next_op(ta, &cs_arg);
+                if ( record_latency ) {
+                    start = lock_read_tsc();
+                    fc_execute(&fc, ta->id, cs_op, cs_arg);
+                    lat_hist_add(ta->hist, lock_read_tsc() - start);
+                } else {
+                    fc_execute(&fc, ta->id, cs_op, cs_arg);
+                }
+                think();
+            }
+            break;
+
+        // the critical sections run on a server thread on its own cpu
+        case DELEGATION:
+            for ( ; i < iters && !stop; i++ ) {
+                ta->deleg_op = next_op(ta, &ta->deleg_arg);
+                if ( record_latency ) {
+                    start = lock_read_tsc();
+                    deleg_execute(&deleg, ta->id, deleg_cs, ta);
+                    lat_hist_add(ta->hist, lock_read_tsc() - start);
+                } else {
+                    deleg_execute(&deleg, ta->id, deleg_cs, ta);
+                }
+                think();
             }
             break;
           
+        // with -H, latencies measure the recording overhead itself
         case DELAY:
-            while ( i++ < iters ) {
-                delay();
-            }
+            LOCK_LOOP(, );
             break;
           
         default:
             break;
     }
+    ta->ops = i;
+    perf_counters_stop(&ta->perf);
 
     pthread_barrier_wait(&bar);
     if ( ta->id == 0 ) timer_stop(&tim);
+    perf_counters_close(&ta->perf);
     
     pthread_exit(NULL);
 } 
 
+/*
+ * Returns the list of runs: every op of ops[], with backoff ops 
+ * repeated for each backoff setting and named after it
+ */ 
+op_desc_t* expand_ops(void)
+{
+    op_desc_t *runs;
+    int op, b, n = 0;
+
+    for ( op = 0; ; op++ ) {
+        n += ops[op].backoff ? nbackoffs : 1;
+        if ( ops[op].code == NO_OP ) break;
+    }
+    runs = (op_desc_t*)malloc_safe(n * sizeof(op_desc_t));
+
+    n = 0;
+    for ( op = 0; ; op++ ) {
+        if ( !ops[op].backoff ) {
+            runs[n++] = ops[op];
+        } else {
+            for ( b = 0; b < nbackoffs; b++ ) {
+                runs[n] = ops[op];
+                runs[n].min_backoff = backoffs[b].min;
+                runs[n].max_backoff = backoffs[b].max;
+                runs[n].name = (char*)malloc_safe(strlen(ops[op].name) + 32);
+                sprintf(runs[n].name, "%s_%u_%u", ops[op].name, 
+                                      backoffs[b].min, backoffs[b].max);
+                n++;
+            }
+        }
+        if ( ops[op].code == NO_OP ) break;
+    }
+
+    return runs;
+}
+
+// per-thread state of the current thread count
+targs_t *targs;
+pthread_t *tids;
+pthread_attr_t *attr;
+mcs_node_t *qnodes;
+clh_node_t *clhnodes;
+lat_hist_t *hists;
+
+// thread i runs on cpusets[thread_slot(i)], in package packages[thread_slot(i)]
+cpu_set_t *cpusets;
+int *packages;
+int ncpus;
+
+// oversubscription: _oversub_ consecutive threads share a cpu (-O),
+// and with _unpinned_ threads may run on any cpu in _allowed_ (-u)
+int oversub = 0;
+int unpinned = 0;
+cpu_set_t allowed;
+
+static inline int thread_slot(int i)
+{
+    return (oversub ? i / oversub : i) % ncpus;
+}
+
+/*
+ * Acquisitions made by a thread: successful ones for timed ops,
+ * iterations otherwise
+ */ 
+static inline unsigned long acquisitions(targs_t *ta)
+{
+    return ta->od->timed ? ta->acquired : ta->ops;
+}
+
+/*
+ * Runs _od_ once on _nthreads_ threads; results are left in targs[]
+ */ 
+void run_op(op_desc_t *od, int nthreads)
+{
+    unsigned long total;
+    int i;
+
+    timer_clear(&tim);
+    stop = 0;
+    last_owner = -1;
+
+    spin_lock_init(&lock);
+    ticket_lock_init(&tlock);
+    mcs_lock_init(&mcslock);
+    clh_lock_init(&clhlock);
+    aclh_lock_init(&aclhlock);
+    cohort_lock_init(&cohortlock, cohort_handoffs);
+    futex_lock_init(&futexlock);
+    backoff_lock_init(&backofflock, od->min_backoff, 
+                      od->max_backoff, 
+                      od->code == SPIN_LOCK_TTAS_BACKOFF_JITTER);
+    pthread_mutex_init(&mutex, NULL);
+    fc_init(&fc, nthreads, NULL, fc_apply_cs);
+    // the server takes the last cpu of the placement
+    if ( od->code == DELEGATION ) {
+        deleg_init(&deleg, nthreads);
+        deleg_start(&deleg, &cpusets[ncpus - 1]);
+    }
+
+    shared_counter.word = 0;
+    pq.size = 0;
+    for ( i = 0; i < PQ_INITIAL_SIZE; i++ )
+        pq_insert(&pq, (0x9e3779b97f4a7c15UL * (i + 1)) % PQ_KEY_RANGE);
+
+    for ( i = 0; i < nthreads; i++ ) {
+        targs[i].id = i;
+        targs[i].package = packages[thread_slot(i)];
+        targs[i].od = od;
+        targs[i].qnode = &qnodes[i];
+        mcs_node_init(&qnodes[i]);
+        targs[i].clhnode = &clhnodes[i];
+        aclh_thread_init(&targs[i].aclh);
+        targs[i].acquired = targs[i].acq_cycles = 0;
+        targs[i].hist = &hists[i];
+        lat_hist_clear(&hists[i]);
+        targs[i].ops = 0;
+        // flat combining and delegation have no lock owner per operation
+        targs[i].track_owner = duration_ms && od->code != DELAY &&
+                               od->code != FLAT_COMBINING &&
+                               od->code != DELEGATION;
+        targs[i].streak = targs[i].max_streak = 0;
+        targs[i].seed = 0x9e3779b97f4a7c15UL * (i + 1);
+        targs[i].pq_insert = 0;
+        pthread_attr_init(&attr[i]);
+        pthread_attr_setaffinity_np(&attr[i], 
+                                    sizeof(cpu_set_t), 
+                                    unpinned ? &allowed : 
+                                               &cpusets[thread_slot(i)]);
+        pthread_create(&tids[i], &attr[i], thread_fn, (void*)&targs[i]);
+    }
+    if ( duration_ms ) {
+        usleep(duration_ms * 1000);
+        stop = 1;
+    }
+
+    for ( i = 0; i < nthreads; i++ ) {
+        pthread_join(tids[i], NULL);
+        pthread_attr_destroy(&attr[i]);
+    }
+    for ( i = 0; i < nthreads; i++ ) 
+        aclh_thread_destroy(&aclhlock, &targs[i].aclh);
+    aclh_lock_destroy(&aclhlock);
+    fc_destroy(&fc);
+    if ( od->code == DELEGATION ) {
+        deleg_stop(&deleg);
+        deleg_destroy(&deleg);
+    }
+
+    if ( cs_struct == CS_COUNTER && od->code != DELAY ) {
+        for ( total = 0, i = 0; i < nthreads; i++ )
+            total += acquisitions(&targs[i]);
+        if ( shared_counter.word != total )
+            fprintf(stderr, "%s: final count %lu, expected %lu\n",
+                            od->name, shared_counter.word, total);
+    }
+}
+
 int main(int argc, char **argv)
 {
-    targs_t *targs;
-    pthread_t *tids;
-    pthread_attr_t *attr;
+    lat_hist_t merged;
+    perf_counters_t perf;
+    op_desc_t *runs;
     procmap_t *pi;
-    int p, c, t, i, nthreads, maxthreads, op;
+    placement_t *pl;
+    char *placement_spec = "compact";
+    int i, nthreads, maxthreads, op, opt, rep, step;
+    unsigned long acquired, acq_cycles, total_ops, max_streak, x;
+    double sum, sumsq, *rates;
+    stats_t rate;
     
-    if ( argc < 3 ) {
-       printf("Usage: ./prog <maxthreads> <iterations>\n");
+    while ( (opt = getopt(argc, argv, "t:k:b:c:r:w:n:S:HT:R:W:O:uP:e:")) != -1 ) {
+        switch ( opt ) {
+            case 'c':
+                cs_cycles = atol(optarg);
+                break;
+            case 'r':
+                lines_read = atoi(optarg);
+                break;
+            case 'w':
+                lines_written = atoi(optarg);
+                break;
+            case 'n':
+                think_cycles = atol(optarg);
+                break;
+            case 'S':
+                if ( !strcmp(optarg, "counter") )
+                    cs_struct = CS_COUNTER;
+                else if ( !strcmp(optarg, "pq") )
+                    cs_struct = CS_PQUEUE;
+                else
+                    argc = 0;
+                break;
+            case 'H':
+                record_latency = 1;
+                break;
+            case 'T':
+                duration_ms = atol(optarg);
+                break;
+            case 'R':
+                reps = atoi(optarg);
+                break;
+            case 'W':
+                warmups = atoi(optarg);
+                break;
+            case 'O':
+                oversub = atoi(optarg);
+                break;
+            case 'u':
+                unpinned = 1;
+                break;
+            case 'P':
+                placement_spec = optarg;
+                break;
+            case 'e':
+                if ( perf_events_parse(optarg) )
+                    argc = 0;
+                break;
+            case 't':
+                timeout_cycles = atol(optarg);
+                break;
+            case 'k':
+                cohort_handoffs = atoi(optarg);
+                break;
+            case 'b':
+                if ( nbackoffs == MAX_BACKOFF_SETTINGS ||
+                     sscanf(optarg, "%u:%u", &backoffs[nbackoffs].min,
+                                             &backoffs[nbackoffs].max) != 2 )
+                    argc = 0;
+                nbackoffs++;
+                break;
+            default:
+                argc = 0;
+        }
+    }
+
+    if ( argc - optind < (duration_ms ? 1 : 2) || reps < 1 || warmups < 0 ||
+         oversub < 0 ) {
+       printf("Usage: ./prog [-H] [-T millisecs] [-R reps] [-W warmups] [-c cs_cycles] [-r lines_read] [-w lines_written] "
+              "[-n think_cycles] [-S counter|pq] [-t timeout_cycles] [-k cohort_handoffs] "
+              "[-b min_backoff:max_backoff]... [-O threads_per_cpu] [-u] "
+              "[-P placement] [-e events] <maxthreads> <iterations>\n");
+       printf("       placement: " PLACEMENT_USAGE " (default: compact)\n");
+       printf("       events: " PERF_EVENTS_USAGE "\n");
+       printf("       with -O, <maxthreads> counts cpus and all locks run "
+              "oversubscribed\n");
+       exit(EXIT_FAILURE);
+    }
+    if ( lines_read < 0 || lines_written < 0 ) {
+       fprintf(stderr, "Negative number of cache lines. Exiting\n");
        exit(EXIT_FAILURE);
     }
+    if ( posix_memalign((void**)&shared_lines, 64, 
+                        (lines_read + lines_written + 1) * sizeof(cache_line_t)) ) {
+        fprintf(stderr, "Allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(shared_lines, 0, (lines_read + lines_written + 1) * sizeof(cache_line_t));
+    if ( nbackoffs == 0 ) 
+        nbackoffs = 1;
+    runs = expand_ops();
+    rates = (double*)malloc_safe(reps * sizeof(double));
   
-    maxthreads = atoi(argv[1]);
-    iters = atol(argv[2]);
+    // with -T, _iterations_ is an optional upper bound
+    maxthreads = atoi(argv[optind]);
+    iters = argc - optind > 1 ? atol(argv[optind + 1]) : ULONG_MAX;
+    // a thread has at most one insert more than its delete-mins
+    pq.keys = (long*)malloc_safe((PQ_INITIAL_SIZE + maxthreads * 
+                                  (oversub ? oversub : 1)) * sizeof(long));
 
     pi = procmap_init();
-    cpu_set_t cpusets[pi->num_cpus];
-
-    // Configure thread affinity: first fill cores, then packages, 
-    // and last peer threads
-    i = 0;
-    fprintf(stdout, "Thread mapping:\n");
-    for ( t = 0; t < pi->num_threads_per_core; t++ ) {
-        for ( p = 0; p < pi->num_packages; p++ ) {
-            for ( c = 0; c < pi->num_cores_per_package; c++ ) {
-                int cpu_id = pi->package[p].core[c].thread[t]->cpu_id;
-                CPU_ZERO(&cpusets[i]);
-                CPU_SET(cpu_id, &cpusets[i]);
-
-                fprintf(stdout, "Thread %d @ package %d, core %d, "
-                                "hw thread %d (cpuid: %d)\n",
-                                i, p, c, t, cpu_id);
-                i++;
-            }
-        }    
+    pl = placement_init(pi, placement_spec);
+    if ( !pl ) {
+        fprintf(stderr, "Invalid placement: %s\n", placement_spec);
+        exit(EXIT_FAILURE);
     }
-    fprintf(stdout, "\n");
+    ncpus = pl->nslots;
+    cpusets = (cpu_set_t*)malloc_safe(ncpus * sizeof(cpu_set_t));
+    packages = (int*)malloc_safe(ncpus * sizeof(int));
+
+    // Configure thread affinity according to the placement policy
+    // (by default, first fill cores, then packages, and last peer 
+    // threads). With more threads than cpus, thread i shares the 
+    // cpu of thread i % ncpus; with -O k, threads k*j .. k*j+k-1 
+    // share the j-th cpu.
+    for ( i = 0; i < ncpus; i++ ) {
+        CPU_ZERO(&cpusets[i]);
+        CPU_SET(pl->slots[i].cpu_id, &cpusets[i]);
+        packages[i] = pl->slots[i].package % COHORT_MAX_NODES;
+    }
+    placement_print(pl, stdout);
+    perf_events_check(stderr);
+
+    fprintf(stdout, "Workload: cs_cycles:%lu lines_read:%d lines_written:%d "
+                    "think_cycles:%lu structure:%s\n", 
+                    cs_cycles, lines_read, lines_written, think_cycles,
+                    cs_struct_names[cs_struct]);
+
+    if ( oversub ) 
+        fprintf(stdout, "Oversubscription: %d threads per cpu\n", oversub);
+    if ( unpinned ) 
+        fprintf(stdout, "Unpinned: threads migrate among the cpus in use\n");
 
     // For all different thread numbers
     fprintf(stdout, "\n");
-    for ( nthreads = 1; nthreads <= maxthreads; nthreads++ ) {
+    step = oversub ? oversub : 1;
+    for ( nthreads = step; nthreads <= maxthreads * step; nthreads += step ) {
 
         fprintf(stdout, "Nthreads=%d\n", nthreads);
         fprintf(stdout, "==============\n");
 
+        CPU_ZERO(&allowed);
+        for ( i = 0; i < nthreads; i++ ) 
+            CPU_OR(&allowed, &allowed, &cpusets[thread_slot(i)]);
+
         // allocate thread structures 
         tids = (pthread_t*)malloc_safe( nthreads * sizeof(pthread_t) );
         targs = (targs_t*)malloc_safe( nthreads * sizeof(targs_t)); 
         attr = (pthread_attr_t*)malloc_safe( nthreads * sizeof(pthread_attr_t)); 
+        // queue nodes must not share cache lines
+        if ( posix_memalign((void**)&qnodes, 64, 
+                            nthreads * sizeof(mcs_node_t)) ||
+             posix_memalign((void**)&clhnodes, 64, 
+                            nthreads * sizeof(clh_node_t)) ||
+             posix_memalign((void**)&hists, 64, 
+                            nthreads * sizeof(lat_hist_t)) ) {
+            fprintf(stderr, "Allocation error\n");
+            exit(EXIT_FAILURE);
+        }
         pthread_barrier_init(&bar, NULL, nthreads);
 
         // for all different operations
         for ( op = 0; ; op++ ) {
-            if ( ops[op].code == NO_OP ) break;
+            if ( runs[op].code == NO_OP ) break;
+            // spinning waiters would only measure the scheduler quantum,
+            // unless oversubscription was asked for (-O)
+            if ( nthreads > ncpus && !oversub && !runs[op].blocking && 
+                 runs[op].code != DELAY ) 
+                continue;
+            // clients must not share the server cpu
+            if ( runs[op].code == DELEGATION && !oversub && nthreads >= ncpus )
+                continue;
   
             fprintf(stdout, "\tnthreads:%d \tlock:%s ", 
-                            nthreads, ops[op].name);
+                            nthreads, runs[op].name);
         
-            timer_clear(&tim);
-
-            spin_lock_init(&lock);
-            pthread_mutex_init(&mutex, NULL);
-
-            for ( i = 0; i < nthreads; i++ ) {
-                targs[i].id = i;
-                targs[i].od = &ops[op];
-                pthread_attr_init(&attr[i]);
-                pthread_attr_setaffinity_np(&attr[i], 
-                                            sizeof(cpusets[i]), 
-                                            &cpusets[i]);
-                pthread_create(&tids[i], &attr[i], thread_fn, (void*)&targs[i]);
+            // warm-up runs are discarded
+            for ( rep = -warmups; rep < reps; rep++ ) {
+                run_op(&runs[op], nthreads);
+                if ( rep < 0 ) 
+                    continue;
+                total_ops = 0;
+                for ( i = 0; i < nthreads; i++ ) 
+                    total_ops += acquisitions(&targs[i]);
+                rates[rep] = total_ops * timer_read_hz() / timer_total(&tim);
             }
+            stats_compute(&rate, rates, reps);
+
+            // the remaining metrics refer to the last run
+            acquired = acq_cycles = total_ops = 0;
+            lat_hist_clear(&merged);
+            perf_counters_clear(&perf);
             for ( i = 0; i < nthreads; i++ ) {
-                pthread_join(tids[i], NULL);
-                pthread_attr_destroy(&attr[i]);
+                acquired += targs[i].acquired;
+                acq_cycles += targs[i].acq_cycles;
+                total_ops += targs[i].ops;
+                lat_hist_merge(&merged, &hists[i]);
+                perf_counters_merge(&perf, &targs[i].perf);
             }
     
-            fprintf(stdout, "\tcycles:%lf\n", 
-                            timer_total(&tim) / (double)iters);
+            // cycles per iteration of a thread, as in the fixed-iteration mode
+            fprintf(stdout, "\tcycles:%lf", 
+                            timer_total(&tim) * nthreads / (double)total_ops);
+            if ( reps > 1 || duration_ms ) 
+                fprintf(stdout, " \tops_per_sec:%lf \tstddev:%lf \tci95:%lf \truns:%d",
+                                rate.mean, rate.stddev, rate.ci95, reps);
+            if ( runs[op].timed ) 
+                fprintf(stdout, " \tsuccess:%lf \tacq_cycles:%lf",
+                                acquired / (double)total_ops,
+                                acquired ? acq_cycles / (double)acquired : 0);
+            // operations applied per combining session
+            if ( runs[op].code == FLAT_COMBINING ) 
+                fprintf(stdout, " \tcombined:%lf",
+                                fc.sessions ? fc.applied / (double)fc.sessions : 0);
+            if ( record_latency ) 
+                fprintf(stdout, " \tp50:%lu \tp90:%lu \tp99:%lu \tp99.9:%lu \tmax:%lu",
+                                lat_hist_quantile(&merged, 0.5),
+                                lat_hist_quantile(&merged, 0.9),
+                                lat_hist_quantile(&merged, 0.99),
+                                lat_hist_quantile(&merged, 0.999),
+                                merged.max);
+            // counts per lock acquisition (per iteration for timed ops)
+            perf_counters_report(stdout, &perf, total_ops);
+            if ( duration_ms && runs[op].code != DELAY ) {
+                // per-thread acquisitions x_i: share, Jain's index 
+                // (sum x_i)^2 / (n * sum x_i^2), longest run of 
+                // consecutive acquisitions by one thread
+                sum = sumsq = 0;
+                max_streak = 0;
+                for ( i = 0; i < nthreads; i++ ) {
+                    x = acquisitions(&targs[i]);
+                    sum += x;
+                    sumsq += (double)x * x;
+                    if ( targs[i].max_streak > max_streak )
+                        max_streak = targs[i].max_streak;
+                }
+                fprintf(stdout, " \tacquisitions:%.0lf \tjain:%lf \tmax_streak:%lu "
+                                "\tshares:", sum, 
+                                sumsq ? sum * sum / (nthreads * sumsq) : 0, 
+                                max_streak);
+                for ( i = 0; i < nthreads; i++ ) {
+                    x = acquisitions(&targs[i]);
+                    fprintf(stdout, "%s%.4lf", i ? "," : "", sum ? x / sum : 0);
+                }
+            }
+            fprintf(stdout, "\n");
         }
     
         pthread_barrier_destroy(&bar);
         free(tids);
         free(targs);
         free(attr);
+        free(qnodes);
+        free(clhnodes);
+        free(hists);
        
         fprintf(stdout, "\n");
     }
 
+    placement_destroy(pl);
     procmap_destroy(pi); 
+    free(runs);
+    free(rates);
+    free(shared_lines);
+    free(pq.keys);
+    free(cpusets);
+    free(packages);
 
     return 0;
 }
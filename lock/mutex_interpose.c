@@ -0,0 +1,492 @@
+/**
+ * @file
+ * LD_PRELOAD library that runs pthread mutexes on lock.h algorithms
+ *
+ * Interposes pthread_mutex_lock / trylock / timedlock / unlock and
+ * the pthread_cond_* calls, so that unmodified binaries use the lock
+ * selected by the SYNCH_MUTEX environment variable:
+ *
+ *      SYNCH_MUTEX=mcs LD_PRELOAD=./libsynchmutex.so ./app
+ *
+ * Algorithms: ttas, ttas-yield, ticket, ticket-yield, mcs, mcs-yield,
+ * futex. If SYNCH_MUTEX is not set, every call goes to the real
+ * pthread functions.
+ *
+ * The lock lives inside the pthread_mutex_t itself, in the bytes that
+ * glibc uses for its own lock word, owner and counters (0-15); the
+ * mutex kind (offset 16) is left alone. All algorithms are free when
+ * these bytes are zero, so statically initialized mutexes
+ * (PTHREAD_MUTEX_INITIALIZER) and pthread_mutex_init() both work.
+ * Only normal (timed) and adaptive mutexes are interposed; recursive,
+ * error-checking, robust, priority-inheritance / protection and
+ * process-shared mutexes are passed on to the real functions.
+ *
+ * glibc's condition variables unlock and relock the mutex through
+ * internal calls that cannot be interposed, so condition variables
+ * are replaced too, by a futex on a sequence number (spurious
+ * wakeups are allowed by POSIX).
+ */
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "lock.h"
+
+typedef enum {
+    PASSTHROUGH = 0,
+    TTAS,
+    TTAS_YIELD,
+    TICKET,
+    TICKET_YIELD,
+    MCS,
+    MCS_YIELD,
+    FUTEX
+} algo_t;
+
+static const struct {
+    const char *name;
+    algo_t algo;
+} algos[] = {
+    { "ttas",         TTAS },
+    { "ttas-yield",   TTAS_YIELD },
+    { "ticket",       TICKET },
+    { "ticket-yield", TICKET_YIELD },
+    { "mcs",          MCS },
+    { "mcs-yield",    MCS_YIELD },
+    { "futex",        FUTEX },
+    { NULL, PASSTHROUGH }
+};
+
+// -1 until the first interposed call
+static volatile int algo = -1;
+
+static int (*real_mutex_lock)(pthread_mutex_t*);
+static int (*real_mutex_trylock)(pthread_mutex_t*);
+static int (*real_mutex_timedlock)(pthread_mutex_t*, const struct timespec*);
+static int (*real_mutex_unlock)(pthread_mutex_t*);
+static int (*real_cond_init)(pthread_cond_t*, const pthread_condattr_t*);
+static int (*real_cond_destroy)(pthread_cond_t*);
+static int (*real_cond_wait)(pthread_cond_t*, pthread_mutex_t*);
+static int (*real_cond_timedwait)(pthread_cond_t*, pthread_mutex_t*,
+                                  const struct timespec*);
+static int (*real_cond_signal)(pthread_cond_t*);
+static int (*real_cond_broadcast)(pthread_cond_t*);
+
+/*
+ * Overlay of the lock state on pthread_mutex_t. _holder_ is the queue
+ * node of the current MCS owner, since unlock does not get one.
+ */
+typedef union {
+    pthread_mutex_t m;
+    struct {
+        union {
+            volatile unsigned int word;
+            ticketlock_t ticket;
+            futexlock_t futex;
+            mcs_node_t * volatile tail;
+        } lock;
+        mcs_node_t *holder;
+    } s;
+} imutex_t;
+
+typedef union {
+    pthread_cond_t c;
+    struct {
+        //! bumped by every signal / broadcast
+        volatile int seq;
+        volatile int waiters;
+        clockid_t clock;
+        int pshared;
+    } s;
+} icond_t;
+
+// the overlays must fit, and leave the mutex kind untouched
+typedef char imutex_fits[sizeof(imutex_t) == sizeof(pthread_mutex_t) &&
+                         offsetof(imutex_t, s.holder) + sizeof(void*) <=
+                         offsetof(pthread_mutex_t, __data.__kind) ? 1 : -1];
+typedef char icond_fits[sizeof(icond_t) == sizeof(pthread_cond_t) ? 1 : -1];
+
+// glibc lock elision hints in __kind, which do not change semantics
+#define KIND_ELISION_FLAGS  0x300
+
+static void resolve(void **fn, const char *name)
+{
+    *fn = dlsym(RTLD_NEXT, name);
+    if ( !*fn ) {
+        fprintf(stderr, "libsynchmutex: cannot resolve %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void interpose_init(void)
+{
+    const char *env = getenv("SYNCH_MUTEX");
+    int i, a = PASSTHROUGH;
+
+    resolve((void**)&real_mutex_lock, "pthread_mutex_lock");
+    resolve((void**)&real_mutex_trylock, "pthread_mutex_trylock");
+    resolve((void**)&real_mutex_timedlock, "pthread_mutex_timedlock");
+    resolve((void**)&real_mutex_unlock, "pthread_mutex_unlock");
+    resolve((void**)&real_cond_init, "pthread_cond_init");
+    resolve((void**)&real_cond_destroy, "pthread_cond_destroy");
+    resolve((void**)&real_cond_wait, "pthread_cond_wait");
+    resolve((void**)&real_cond_timedwait, "pthread_cond_timedwait");
+    resolve((void**)&real_cond_signal, "pthread_cond_signal");
+    resolve((void**)&real_cond_broadcast, "pthread_cond_broadcast");
+
+    if ( env && *env ) {
+        for ( i = 0; algos[i].name; i++ )
+            if ( !strcmp(env, algos[i].name) )
+                a = algos[i].algo;
+        if ( a == PASSTHROUGH )
+            fprintf(stderr, "libsynchmutex: unknown SYNCH_MUTEX %s, "
+                            "using pthread mutexes\n", env);
+    }
+
+    __asm__ __volatile__ ("" ::: "memory");
+    algo = a;
+}
+
+__attribute__ ((constructor)) static void interpose_ctor(void)
+{
+    if ( algo < 0 )
+        interpose_init();
+}
+
+static inline int interposed(pthread_mutex_t *m)
+{
+    int kind;
+
+    if ( algo < 0 )
+        interpose_init();
+    if ( algo == PASSTHROUGH )
+        return 0;
+
+    kind = m->__data.__kind & ~KIND_ELISION_FLAGS;
+    return kind == PTHREAD_MUTEX_TIMED_NP || kind == PTHREAD_MUTEX_ADAPTIVE_NP;
+}
+
+/*
+ * Test-and-test-and-set on a zero-initialized word (0: free),
+ * as spin_lock_cas() but with inverted values
+ */
+static inline void ttas_lock(volatile unsigned int *w, int yield)
+{
+    unsigned int spins = 0;
+
+    while ( xchg_u32(w, 1) ) {
+        while ( *w ) {
+            if ( yield )
+                cpu_relax_or_yield(&spins);
+            else
+                cpu_relax();
+        }
+    }
+}
+
+static inline int ttas_trylock(volatile unsigned int *w)
+{
+    return *w == 0 && xchg_u32(w, 1) == 0 ? 0 : LOCK_BUSY;
+}
+
+static inline void ttas_unlock(volatile unsigned int *w)
+{
+    __asm__ __volatile__ ("" ::: "memory");
+    *w = 0;
+}
+
+/*
+ * MCS queue nodes: a thread needs one per mutex it holds (or waits
+ * for), released in any order. The first MCS_TLS_NODES come from a
+ * thread-local pool, the rest from the heap.
+ */
+#define MCS_TLS_NODES 16
+
+static __thread mcs_node_t tls_nodes[MCS_TLS_NODES];
+static __thread unsigned int tls_nodes_used;
+
+static mcs_node_t* node_alloc(void)
+{
+    mcs_node_t *node;
+    int i = ffs(~tls_nodes_used);
+
+    if ( i && i <= MCS_TLS_NODES ) {
+        tls_nodes_used |= 1U << (i - 1);
+        return &tls_nodes[i - 1];
+    }
+    if ( posix_memalign((void**)&node, 64, sizeof(mcs_node_t)) )
+        abort();
+    return node;
+}
+
+static void node_free(mcs_node_t *node)
+{
+    if ( node >= tls_nodes && node < tls_nodes + MCS_TLS_NODES )
+        tls_nodes_used &= ~(1U << (node - tls_nodes));
+    else
+        free(node);
+}
+
+static inline void imutex_lock(imutex_t *im)
+{
+    mcs_node_t *node;
+
+    switch ( algo ) {
+        case TTAS:
+            ttas_lock(&im->s.lock.word, 0);
+            break;
+        case TTAS_YIELD:
+            ttas_lock(&im->s.lock.word, 1);
+            break;
+        case TICKET:
+            ticket_lock(&im->s.lock.ticket);
+            break;
+        case TICKET_YIELD:
+            ticket_lock_yield(&im->s.lock.ticket);
+            break;
+        case MCS:
+        case MCS_YIELD:
+            node = node_alloc();
+            if ( algo == MCS )
+                mcs_lock((mcs_lock_t*)&im->s.lock.tail, node);
+            else
+                mcs_lock_yield((mcs_lock_t*)&im->s.lock.tail, node);
+            im->s.holder = node;
+            break;
+        case FUTEX:
+            futex_lock(&im->s.lock.futex);
+            break;
+        default:
+            break;
+    }
+}
+
+static inline int imutex_trylock(imutex_t *im)
+{
+    mcs_node_t *node;
+    int ret = LOCK_BUSY;
+
+    switch ( algo ) {
+        case TTAS:
+        case TTAS_YIELD:
+            ret = ttas_trylock(&im->s.lock.word);
+            break;
+        case TICKET:
+        case TICKET_YIELD:
+            ret = ticket_trylock(&im->s.lock.ticket);
+            break;
+        case MCS:
+        case MCS_YIELD:
+            node = node_alloc();
+            ret = mcs_trylock((mcs_lock_t*)&im->s.lock.tail, node);
+            if ( ret == 0 )
+                im->s.holder = node;
+            else
+                node_free(node);
+            break;
+        case FUTEX:
+            ret = futex_trylock(&im->s.lock.futex);
+            break;
+        default:
+            break;
+    }
+
+    return ret ? EBUSY : 0;
+}
+
+static inline void imutex_unlock(imutex_t *im)
+{
+    mcs_node_t *node;
+
+    switch ( algo ) {
+        case TTAS:
+        case TTAS_YIELD:
+            ttas_unlock(&im->s.lock.word);
+            break;
+        case TICKET:
+        case TICKET_YIELD:
+            ticket_unlock(&im->s.lock.ticket);
+            break;
+        case MCS:
+        case MCS_YIELD:
+            // _holder_ overlaps glibc's user count: leave it zero
+            node = im->s.holder;
+            im->s.holder = NULL;
+            if ( algo == MCS )
+                mcs_unlock((mcs_lock_t*)&im->s.lock.tail, node);
+            else
+                mcs_unlock_yield((mcs_lock_t*)&im->s.lock.tail, node);
+            node_free(node);
+            break;
+        case FUTEX:
+            futex_unlock(&im->s.lock.futex);
+            break;
+        default:
+            break;
+    }
+}
+
+static int timespec_passed(const struct timespec *abstime, clockid_t clock)
+{
+    struct timespec now;
+
+    clock_gettime(clock, &now);
+    return now.tv_sec > abstime->tv_sec ||
+           (now.tv_sec == abstime->tv_sec && now.tv_nsec >= abstime->tv_nsec);
+}
+
+int pthread_mutex_lock(pthread_mutex_t *m)
+{
+    if ( !interposed(m) )
+        return real_mutex_lock(m);
+
+    imutex_lock((imutex_t*)m);
+    return 0;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *m)
+{
+    if ( !interposed(m) )
+        return real_mutex_trylock(m);
+
+    return imutex_trylock((imutex_t*)m);
+}
+
+int pthread_mutex_timedlock(pthread_mutex_t *m, const struct timespec *abstime)
+{
+    if ( !interposed(m) )
+        return real_mutex_timedlock(m, abstime);
+
+    if ( abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000L )
+        return EINVAL;
+
+    // poll, giving up the cpu between attempts
+    while ( imutex_trylock((imutex_t*)m) ) {
+        if ( timespec_passed(abstime, CLOCK_REALTIME) )
+            return ETIMEDOUT;
+        sched_yield();
+    }
+    return 0;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *m)
+{
+    if ( !interposed(m) )
+        return real_mutex_unlock(m);
+
+    imutex_unlock((imutex_t*)m);
+    return 0;
+}
+
+static inline int cond_interposed(void)
+{
+    if ( algo < 0 )
+        interpose_init();
+    return algo != PASSTHROUGH;
+}
+
+int pthread_cond_init(pthread_cond_t *c, const pthread_condattr_t *attr)
+{
+    icond_t *ic = (icond_t*)c;
+
+    if ( !cond_interposed() )
+        return real_cond_init(c, attr);
+
+    memset(c, 0, sizeof(pthread_cond_t));
+    ic->s.clock = CLOCK_REALTIME;
+    if ( attr ) {
+        pthread_condattr_getclock(attr, &ic->s.clock);
+        pthread_condattr_getpshared(attr, &ic->s.pshared);
+    }
+    return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t *c)
+{
+    if ( !cond_interposed() )
+        return real_cond_destroy(c);
+
+    return 0;
+}
+
+static int cond_wait(icond_t *ic, pthread_mutex_t *m,
+                     const struct timespec *abstime)
+{
+    struct timespec *ts = (struct timespec*)abstime;
+    int seq, op, ret = 0;
+
+    if ( abstime && (abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000L) )
+        return EINVAL;
+
+    fetch_add_int(&ic->s.waiters, 1);
+    seq = ic->s.seq;
+    pthread_mutex_unlock(m);
+
+    // FUTEX_WAIT_BITSET takes an absolute timeout on the cond's clock
+    op = FUTEX_WAIT_BITSET;
+    if ( !ic->s.pshared )
+        op |= FUTEX_PRIVATE_FLAG;
+    if ( abstime && ic->s.clock == CLOCK_REALTIME )
+        op |= FUTEX_CLOCK_REALTIME;
+    if ( syscall(SYS_futex, &ic->s.seq, op, seq, ts, NULL,
+                 FUTEX_BITSET_MATCH_ANY) == -1 && errno == ETIMEDOUT )
+        ret = ETIMEDOUT;
+
+    fetch_add_int(&ic->s.waiters, -1);
+    pthread_mutex_lock(m);
+    return ret;
+}
+
+int pthread_cond_wait(pthread_cond_t *c, pthread_mutex_t *m)
+{
+    if ( !cond_interposed() )
+        return real_cond_wait(c, m);
+
+    return cond_wait((icond_t*)c, m, NULL);
+}
+
+int pthread_cond_timedwait(pthread_cond_t *c, pthread_mutex_t *m,
+                           const struct timespec *abstime)
+{
+    if ( !cond_interposed() )
+        return real_cond_timedwait(c, m, abstime);
+
+    return cond_wait((icond_t*)c, m, abstime);
+}
+
+static int cond_wake(icond_t *ic, int nwake)
+{
+    // the waiter counts itself before reading _seq_, so either it
+    // sees the new _seq_ or we see it waiting
+    fetch_add_int(&ic->s.seq, 1);
+    if ( ic->s.waiters )
+        syscall(SYS_futex, &ic->s.seq,
+                ic->s.pshared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, nwake,
+                NULL, NULL, 0);
+    return 0;
+}
+
+int pthread_cond_signal(pthread_cond_t *c)
+{
+    if ( !cond_interposed() )
+        return real_cond_signal(c);
+
+    return cond_wake((icond_t*)c, 1);
+}
+
+int pthread_cond_broadcast(pthread_cond_t *c)
+{
+    if ( !cond_interposed() )
+        return real_cond_broadcast(c);
+
+    return cond_wake((icond_t*)c, INT_MAX);
+}
@@ -7,4 +7,53 @@ outfile=$(hostname)_lock_scalability_output.txt
 rm -f $outfile
 
 proc_num=$(cat /proc/cpuinfo | grep "processor" | wc -l)
-./locks_scalability $proc_num 10000000 >> $outfile
+# blocking locks also run oversubscribed, up to 2 threads per cpu
+./locks_scalability $((2 * proc_num)) 10000000 >> $outfile
+
+# time-bounded runs (1 sec per lock and thread count) with fairness metrics
+fair_outfile=$(hostname)_lock_fairness_output.txt
+rm -f $fair_outfile
+./locks_scalability -T 1000 $proc_num >> $fair_outfile
+
+# locks and flat combining protecting a shared counter and a priority queue
+fc_outfile=$(hostname)_lock_structures_output.txt
+rm -f $fc_outfile
+for structure in counter pq
+do
+    ./locks_scalability -S $structure $proc_num 10000000 >> $fc_outfile
+done
+
+rw_outfile=$(hostname)_rw_scalability_output.txt
+rm -f $rw_outfile
+for ratio in 99:1 9:1 1:1
+do
+    ./rw_scalability -r $ratio $proc_num 10000000 >> $rw_outfile
+done
+
+# lock handoff latency for every pair of cpus
+./handoff_latency 100000 > $(hostname)_handoff_latency_output.txt
+
+# oversubscribed runs (2 and 4 threads per cpu), pinned and unpinned
+over_outfile=$(hostname)_lock_oversubscription_output.txt
+rm -f $over_outfile
+for factor in 2 4
+do
+    ./locks_scalability -O $factor -T 1000 $proc_num >> $over_outfile
+    ./locks_scalability -O $factor -u -T 1000 $proc_num >> $over_outfile
+done
+
+# barrier episodes, balanced and with up to 10000 cycles of imbalance
+bar_outfile=$(hostname)_barrier_scalability_output.txt
+rm -f $bar_outfile
+for imbalance in 0 10000
+do
+    ./barriers_scalability -i $imbalance $proc_num 1000000 >> $bar_outfile
+done
+
+# shared counters and non-zero indicators, update-only and with reads
+cnt_outfile=$(hostname)_counter_scalability_output.txt
+rm -f $cnt_outfile
+for read_every in 0 100
+do
+    ./counter_scalability -r $read_every $proc_num 10000000 >> $cnt_outfile
+done
@@ -0,0 +1,315 @@
+/**
+ * @file
+ * Tests scalability of reader-writer lock implementations
+ * under a configurable read:write mix
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "lock.h"
+#include "util/tsc_x86_64.h"
+#include "util/processor_map.h"
+#include "util/util.h"
+#include "bench/placement.h"
+
+unsigned long iters;
+// read:write ratio
+unsigned int reads = 9, writes = 1;
+pthread_barrier_t bar;
+tsctimer_t tim;
+
+spinlock_t lock;
+rwlock_t rwlock;
+rwlock_wpref_t rwlock_wpref;
+brlock_t brlock;
+pthread_rwlock_t prwlock;
+
+// data protected by the locks
+#define SHARED_WORDS 8
+volatile unsigned long shared_data[SHARED_WORDS] __attribute__ ((aligned (64)));
+
+typedef enum {
+    NO_OP = 0,
+    SPIN_LOCK_TTAS,
+    RW_LOCK,
+    RW_LOCK_WPREF,
+    BR_LOCK,
+    PTHREAD_RWLOCK
+} opcode_t;
+
+typedef struct {
+    opcode_t code;
+    char *name;
+} op_desc_t;
+
+#define INIT_OP(o) {.code = o, .name = #o}
+
+op_desc_t ops[] = {
+    INIT_OP(SPIN_LOCK_TTAS),
+    INIT_OP(RW_LOCK),
+    INIT_OP(RW_LOCK_WPREF),
+    INIT_OP(BR_LOCK),
+    INIT_OP(PTHREAD_RWLOCK),
+    INIT_OP(NO_OP)
+};
+
+typedef struct {
+    int id;
+    //! big-reader slot: placement index (not cpu id) of the thread's cpu
+    int cpu;
+    op_desc_t *od;
+} targs_t;
+
+static inline void read_cs(void)
+{
+    unsigned long sum = 0;
+    int i;
+
+    for ( i = 0; i < SHARED_WORDS; i++ )
+        sum += shared_data[i];
+    __asm__ __volatile__ ("" :: "r" (sum));
+}
+
+static inline void write_cs(void)
+{
+    int i;
+
+    for ( i = 0; i < SHARED_WORDS; i++ )
+        shared_data[i]++;
+}
+
+/*
+ * Per-thread xorshift generator; decides whether the next
+ * operation is a write, so that writes are spread randomly
+ * instead of in lockstep among threads
+ */
+static inline int next_is_write(unsigned int *seed)
+{
+    unsigned int x = *seed;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+
+    return x % (reads + writes) < writes;
+}
+
+void* thread_fn(void *args)
+{
+    unsigned long i = 0;
+    unsigned int seed;
+    targs_t *ta = (targs_t*)args;
+
+    seed = 2463534242U + ta->id;
+
+    pthread_barrier_wait(&bar);
+    if ( ta->id == 0 ) timer_start(&tim);
+
+    switch ( ta->od->code ) {
+
+        case SPIN_LOCK_TTAS:
+            while ( i++ < iters ) {
+                spin_lock_cas(&lock);
+                if ( next_is_write(&seed) )
+                    write_cs();
+                else
+                    read_cs();
+                spin_unlock(&lock);
+            }
+            break;
+
+        case RW_LOCK:
+            while ( i++ < iters ) {
+                if ( next_is_write(&seed) ) {
+                    rw_write_lock(&rwlock);
+                    write_cs();
+                    rw_write_unlock(&rwlock);
+                } else {
+                    rw_read_lock(&rwlock);
+                    read_cs();
+                    rw_read_unlock(&rwlock);
+                }
+            }
+            break;
+
+        case RW_LOCK_WPREF:
+            while ( i++ < iters ) {
+                if ( next_is_write(&seed) ) {
+                    rw_wpref_write_lock(&rwlock_wpref);
+                    write_cs();
+                    rw_wpref_write_unlock(&rwlock_wpref);
+                } else {
+                    rw_wpref_read_lock(&rwlock_wpref);
+                    read_cs();
+                    rw_wpref_read_unlock(&rwlock_wpref);
+                }
+            }
+            break;
+
+        case BR_LOCK:
+            while ( i++ < iters ) {
+                if ( next_is_write(&seed) ) {
+                    br_write_lock(&brlock);
+                    write_cs();
+                    br_write_unlock(&brlock);
+                } else {
+                    br_read_lock(&brlock, ta->cpu);
+                    read_cs();
+                    br_read_unlock(&brlock, ta->cpu);
+                }
+            }
+            break;
+
+        case PTHREAD_RWLOCK:
+            while ( i++ < iters ) {
+                if ( next_is_write(&seed) ) {
+                    pthread_rwlock_wrlock(&prwlock);
+                    write_cs();
+                    pthread_rwlock_unlock(&prwlock);
+                } else {
+                    pthread_rwlock_rdlock(&prwlock);
+                    read_cs();
+                    pthread_rwlock_unlock(&prwlock);
+                }
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    pthread_barrier_wait(&bar);
+    if ( ta->id == 0 ) timer_stop(&tim);
+
+    pthread_exit(NULL);
+}
+
+int main(int argc, char **argv)
+{
+    targs_t *targs;
+    pthread_t *tids;
+    pthread_attr_t *attr;
+    procmap_t *pi;
+    placement_t *pl;
+    char *placement_spec = "compact";
+    int i, nthreads, maxthreads, op, opt, ncpus;
+
+    while ( (opt = getopt(argc, argv, "r:P:")) != -1 ) {
+        switch ( opt ) {
+            case 'r':
+                if ( sscanf(optarg, "%u:%u", &reads, &writes) != 2 ||
+                     reads + writes == 0 )
+                    argc = 0;
+                break;
+            case 'P':
+                placement_spec = optarg;
+                break;
+            default:
+                argc = 0;
+        }
+    }
+
+    if ( argc - optind < 2 ) {
+       printf("Usage: ./prog [-r reads:writes] [-P placement] <maxthreads> <iterations>\n");
+       printf("       placement: " PLACEMENT_USAGE " (default: compact)\n");
+       exit(EXIT_FAILURE);
+    }
+
+    maxthreads = atoi(argv[optind]);
+    iters = atol(argv[optind + 1]);
+
+    pi = procmap_init();
+    pl = placement_init(pi, placement_spec);
+    if ( !pl ) {
+        fprintf(stderr, "Invalid placement: %s\n", placement_spec);
+        exit(EXIT_FAILURE);
+    }
+    ncpus = pl->nslots;
+    cpu_set_t cpusets[ncpus];
+
+    if ( ncpus > BRLOCK_MAX_CPUS ) {
+        fprintf(stderr, "More than %d cpus. Exiting\n", BRLOCK_MAX_CPUS);
+        exit(EXIT_FAILURE);
+    }
+
+    // Configure thread affinity according to the placement policy
+    // (by default, first fill cores, then packages, and last peer 
+    // threads); thread i uses the big-reader slot of its cpu index
+    for ( i = 0; i < ncpus; i++ ) {
+        CPU_ZERO(&cpusets[i]);
+        CPU_SET(pl->slots[i].cpu_id, &cpusets[i]);
+    }
+    placement_print(pl, stdout);
+
+    // For all different thread numbers
+    fprintf(stdout, "\n");
+    for ( nthreads = 1; nthreads <= maxthreads; nthreads++ ) {
+
+        fprintf(stdout, "Nthreads=%d\n", nthreads);
+        fprintf(stdout, "==============\n");
+
+        // allocate thread structures
+        tids = (pthread_t*)malloc_safe( nthreads * sizeof(pthread_t) );
+        targs = (targs_t*)malloc_safe( nthreads * sizeof(targs_t));
+        attr = (pthread_attr_t*)malloc_safe( nthreads * sizeof(pthread_attr_t));
+        pthread_barrier_init(&bar, NULL, nthreads);
+
+        // for all different operations
+        for ( op = 0; ; op++ ) {
+            if ( ops[op].code == NO_OP ) break;
+
+            fprintf(stdout, "\tnthreads:%d \tlock:%s \treads:%u \twrites:%u ",
+                            nthreads, ops[op].name, reads, writes);
+
+            timer_clear(&tim);
+
+            spin_lock_init(&lock);
+            rw_lock_init(&rwlock);
+            rw_wpref_lock_init(&rwlock_wpref);
+            br_lock_init(&brlock, ncpus);
+            pthread_rwlock_init(&prwlock, NULL);
+
+            for ( i = 0; i < nthreads; i++ ) {
+                targs[i].id = i;
+                // slots are indexed by placement slot, which is dense
+                // and below ncpus, while cpu ids may be sparse and
+                // exceed BRLOCK_MAX_CPUS
+                targs[i].cpu = i % ncpus;
+                targs[i].od = &ops[op];
+                pthread_attr_init(&attr[i]);
+                pthread_attr_setaffinity_np(&attr[i],
+                                            sizeof(cpusets[i % ncpus]),
+                                            &cpusets[i % ncpus]);
+                pthread_create(&tids[i], &attr[i], thread_fn, (void*)&targs[i]);
+            }
+            for ( i = 0; i < nthreads; i++ ) {
+                pthread_join(tids[i], NULL);
+                pthread_attr_destroy(&attr[i]);
+            }
+            pthread_rwlock_destroy(&prwlock);
+
+            fprintf(stdout, "\tcycles:%lf\n",
+                            timer_total(&tim) / (double)iters);
+        }
+
+        pthread_barrier_destroy(&bar);
+        free(tids);
+        free(targs);
+        free(attr);
+
+        fprintf(stdout, "\n");
+    }
+
+    placement_destroy(pl);
+    procmap_destroy(pi);
+
+    return 0;
+}
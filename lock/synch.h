@@ -2,6 +2,11 @@
 #define __SYNCH_H_
 
 #include <asm/unistd.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 /**************************** ATOMIC OPERATIONS *********************************/
 static inline void atomic_inc(unsigned int *v)
@@ -12,6 +17,119 @@ static inline void atomic_inc(unsigned int *v)
 }
 
 
+/*
+ * Atomically increments *v by 1 and returns the new value
+ */
+static inline unsigned int atomic_inc_return(unsigned int *v)
+{
+    unsigned int i = 1;
+
+    __asm__ __volatile__( "lock; xaddl %0, %1"
+                            :"+r" (i), "+m" (*v)
+                            :
+                            : "memory");
+    return i + 1;
+}
+
+
+/*
+ * Atomically stores _val_ to *v and returns the previous value
+ */
+static inline unsigned int atomic_xchg(unsigned int *v, unsigned int val)
+{
+    __asm__ __volatile__( "xchgl %0, %1"
+                            :"+r" (val), "+m" (*v)
+                            :
+                            : "memory");
+    return val;
+}
+
+static inline unsigned long atomic_xchg64(unsigned long *v, unsigned long val)
+{
+    __asm__ __volatile__( "xchgq %0, %1"
+                            :"+r" (val), "+m" (*v)
+                            :
+                            : "memory");
+    return val;
+}
+
+
+/*
+ * Atomically adds _i_ to *v and returns the previous value
+ */
+static inline unsigned int atomic_xadd(unsigned int *v, int i)
+{
+    __asm__ __volatile__( "lock; xaddl %0, %1"
+                            :"+r" (i), "+m" (*v)
+                            :
+                            : "memory");
+    return i;
+}
+
+static inline unsigned long atomic_xadd64(unsigned long *v, long i)
+{
+    __asm__ __volatile__( "lock; xaddq %0, %1"
+                            :"+r" (i), "+m" (*v)
+                            :
+                            : "memory");
+    return i;
+}
+
+
+/*
+ * If *v == old, atomically stores _new_ to *v; returns the previous 
+ * value of *v (the swap took place iff it equals _old_)
+ */
+static inline unsigned int atomic_cmpxchg(unsigned int *v, unsigned int old,
+                                          unsigned int new)
+{
+    unsigned int prev;
+
+    __asm__ __volatile__( "lock; cmpxchgl %2, %1"
+                            :"=a" (prev), "+m" (*v)
+                            :"r" (new), "0" (old)
+                            : "memory");
+    return prev;
+}
+
+static inline unsigned long atomic_cmpxchg64(unsigned long *v, unsigned long old,
+                                             unsigned long new)
+{
+    unsigned long prev;
+
+    __asm__ __volatile__( "lock; cmpxchgq %2, %1"
+                            :"=a" (prev), "+m" (*v)
+                            :"r" (new), "0" (old)
+                            : "memory");
+    return prev;
+}
+
+
+/*
+ * Double-width (16-byte) compare and swap, e.g. for a pointer and a
+ * version tag. The target must be 16-byte aligned. Returns 1 if *v
+ * matched *old and was replaced by _new_; otherwise returns 0 and 
+ * loads the current value of *v into *old.
+ */
+typedef struct {
+    unsigned long lo;
+    unsigned long hi;
+} __attribute__ ((aligned (16))) atomic128_t;
+
+static inline int atomic_cmpxchg128(atomic128_t *v, atomic128_t *old,
+                                    atomic128_t new)
+{
+    unsigned char ok;
+
+    __asm__ __volatile__( "lock; cmpxchg16b %1; sete %0"
+                            :"=q" (ok), "+m" (*v),
+                             "+a" (old->lo), "+d" (old->hi)
+                            :"b" (new.lo), "c" (new.hi)
+                            : "memory");
+    return ok;
+}
+
+
 /*
  * Atomically decrements *v by 1 and returns true if the result is 0, 
  * or false for all other cases.
@@ -174,6 +292,14 @@ static inline void spin_on_condition_ineq(spin_t *spin_var, const int condition_
 
 
 
+/*
+ * The cpu_halt variants below need a patched kernel (custom syscall
+ * 256) and the cpuctrl driver; build with -DCPUCTRL to enable them.
+ * futex_barrier() gives the same spin-then-halt behavior on stock
+ * kernels.
+ */
+#ifdef CPUCTRL
+
 #define __syscall_clobber "r11","rcx","memory"
 
 //here we use cpu_halt() custom syscall (number: 256) instead of ioctl implementation
@@ -216,6 +342,7 @@ static inline void spin_on_condition_ineq_cpuhalt(spin_t *spin_var, const int co
 
 }
 
+#endif
 
 
 /********************************* BARRIERS  **********************************/
@@ -273,12 +400,9 @@ static inline void spin_barrier_lsense(spin_barrier_t *sb, unsigned int *lsense)
 {
     *lsense = !(*lsense);
 
-    __asm__ __volatile__(
-            "lock; incl %0" 
-            :"=m" (sb->current_count)
-            :"m" (sb->current_count));
-
-    if(sb->current_count == sb->nthreads) {
+    // only the last arrival may see the full count: a thread that
+    // re-read it could reset the count of the next episode
+    if(atomic_inc_return((unsigned int*)&sb->current_count) == sb->nthreads) {
         sb->current_count = 0;
         sb->release_flag = *lsense;
     } else
@@ -286,34 +410,26 @@ static inline void spin_barrier_lsense(spin_barrier_t *sb, unsigned int *lsense)
 }
 
 
+#ifdef CPUCTRL
 static inline void spin_barrier_lsense_cpuhalt(spin_barrier_t *sb, unsigned int *lsense)
 {
     *lsense = !(*lsense);
 
-    __asm__ __volatile__(
-            "lock; incl %0" 
-            :"=m" (sb->current_count)
-            :"m" (sb->current_count));
-
-    if(sb->current_count == sb->nthreads) {
+    if(atomic_inc_return((unsigned int*)&sb->current_count) == sb->nthreads) {
         sb->current_count = 0;
         sb->release_flag = *lsense;
     } else
         spin_on_condition_cpuhalt(&(sb->release_flag), *lsense);
 }
 
+#include <sys/ioctl.h>
 #include "cpuctrl.h"
 extern int cpuctrl_fd;
 static inline void spin_barrier_lsense_cpuhalt_sendIPI(spin_barrier_t *sb, unsigned int *lsense)
 {
     *lsense = !(*lsense);
 
-    __asm__ __volatile__(
-            "lock; incl %0" 
-            :"=m" (sb->current_count)
-            :"m" (sb->current_count));
-
-    if(sb->current_count == sb->nthreads) {
+    if(atomic_inc_return((unsigned int*)&sb->current_count) == sb->nthreads) {
         sb->current_count = 0;
         sb->release_flag = *lsense;
         ioctl(cpuctrl_fd, CPUCTRL_IOC_WAKEUP_ALLBUTSELF, 0); 
@@ -321,6 +437,7 @@ static inline void spin_barrier_lsense_cpuhalt_sendIPI(spin_barrier_t *sb, unsig
         spin_on_condition_cpuhalt(&(sb->release_flag), *lsense);
 }
 
+#endif
 
 
 /*
@@ -358,4 +475,728 @@ static inline void spin_barrier(spin_barrier_t *sb)
 }   
 
 
+/*************************** SCALABLE BARRIERS ********************************/
+/*
+ * The barriers below spin only on flags that a single, statically 
+ * known thread writes, each on its own cache line, instead of on 
+ * one shared counter and release flag (Mellor-Crummey and Scott, 
+ * TOCS 1991). Every thread keeps a barrier_local_t with its id 
+ * (0 .. nthreads-1) and its local sense.
+ *
+ * example:
+ *  dissem_barrier_t gbarrier;              //global
+ *  ...
+ *  dissem_barrier_init(&gbarrier, nthreads);
+ *  for(i=0; i<nthreads; i++)               //init local state
+ *      barrier_local_init(&targs[i].bl, i);
+ *  ...
+ *  dissem_barrier(&gbarrier, &targs[id].bl); //in thread _id_
+ *  ...
+ *  dissem_barrier_destroy(&gbarrier);
+ */
+
+typedef struct {
+    spin_t flag;
+} __attribute__ ((aligned (64))) padded_spin_t;
+
+typedef struct {
+    int id;
+    unsigned int sense;
+    //! which of the two flag sets to use (dissemination barrier only)
+    unsigned int parity;
+    //! running average of spins before release (futex barrier only)
+    int spins;
+} barrier_local_t;
+
+static inline void barrier_local_init(barrier_local_t *bl, int id)
+{
+    bl->id = id;
+    bl->sense = 1;
+    bl->parity = 0;
+    bl->spins = 0;
+}
+
+static inline void* cacheline_alloc(size_t size)
+{
+    void *p;
+
+    if ( posix_memalign(&p, 64, size) )
+        abort();
+    return p;
+}
+
+// ceil(log2(n))
+static inline int barrier_log2(int n)
+{
+    int k = 0;
+
+    while ( (1 << k) < n )
+        k++;
+    return k;
+}
+
+
+/*
+ * Dissemination barrier (Hensgen, Finkel and Manber).
+ * In round k thread i signals thread (i + 2^k) mod P and waits 
+ * for the signal of thread (i - 2^k) mod P; after ceil(log2 P) 
+ * rounds every thread has (transitively) heard from all others.
+ * There is no separate wakeup phase. Two sets of flags, used on 
+ * alternate episodes, keep a fast thread of the next episode from
+ * overwriting a flag that a slow partner has not seen yet; the 
+ * sense flips every other episode.
+ */
+typedef struct {
+    int nthreads;
+    int rounds;
+    //! flags[(id * 2 + parity) * rounds + k]
+    padded_spin_t *flags;
+} dissem_barrier_t;
+
+static inline void dissem_barrier_init(dissem_barrier_t *db, int nthreads)
+{
+    int i;
+
+    db->nthreads = nthreads;
+    db->rounds = barrier_log2(nthreads);
+    db->flags = (padded_spin_t*)cacheline_alloc(
+                    (size_t)nthreads * 2 * (db->rounds + 1) * sizeof(padded_spin_t));
+    for ( i = 0; i < nthreads * 2 * (db->rounds + 1); i++ )
+        db->flags[i].flag = 0;
+}
+
+static inline void dissem_barrier(dissem_barrier_t *db, barrier_local_t *bl)
+{
+    int k, partner;
+    padded_spin_t *mine;
+
+    __asm__ __volatile__ ("" ::: "memory");
+    mine = &db->flags[(bl->id * 2 + bl->parity) * db->rounds];
+    for ( k = 0; k < db->rounds; k++ ) {
+        partner = (bl->id + (1 << k)) % db->nthreads;
+        db->flags[(partner * 2 + bl->parity) * db->rounds + k].flag = bl->sense;
+        spin_on_condition(&mine[k].flag, bl->sense);
+    }
+    if ( bl->parity )
+        bl->sense = !bl->sense;
+    bl->parity = !bl->parity;
+    __asm__ __volatile__ ("" ::: "memory");
+}
+
+static inline void dissem_barrier_destroy(dissem_barrier_t *db)
+{
+    free(db->flags);
+}
+
+
+/*
+ * Tournament barrier (Hensgen, Finkel and Manber; MCS variant with
+ * tree wakeup). In round k the thread whose id is a multiple of 
+ * 2^(k+1) is the winner and waits for its opponent, id + 2^k (if 
+ * there is one); the opponent signals the winner's arrival flag 
+ * and drops out to wait on its own wakeup flag. Thread 0 wins the
+ * tournament and wakes up, in reverse round order, the threads it
+ * beat; every woken thread does the same.
+ */
+typedef struct {
+    int nthreads;
+    int rounds;
+    //! arrive[id * rounds + k]: the loser of round k reached _id_
+    padded_spin_t *arrive;
+    //! wake[id]: the thread that beat _id_ released it
+    padded_spin_t *wake;
+} tourn_barrier_t;
+
+static inline void tourn_barrier_init(tourn_barrier_t *tb, int nthreads)
+{
+    int i;
+
+    tb->nthreads = nthreads;
+    tb->rounds = barrier_log2(nthreads);
+    tb->arrive = (padded_spin_t*)cacheline_alloc(
+                    (size_t)nthreads * (tb->rounds + 1) * sizeof(padded_spin_t));
+    tb->wake = (padded_spin_t*)cacheline_alloc(nthreads * sizeof(padded_spin_t));
+    for ( i = 0; i < nthreads * (tb->rounds + 1); i++ )
+        tb->arrive[i].flag = 0;
+    for ( i = 0; i < nthreads; i++ )
+        tb->wake[i].flag = 0;
+}
+
+static inline void tourn_barrier(tourn_barrier_t *tb, barrier_local_t *bl)
+{
+    int id = bl->id, k, step;
+
+    __asm__ __volatile__ ("" ::: "memory");
+    for ( k = 0; k < tb->rounds; k++ ) {
+        step = 1 << k;
+        if ( id & step ) {
+            // lost round k: report to the winner and wait to be woken
+            tb->arrive[(id - step) * tb->rounds + k].flag = bl->sense;
+            spin_on_condition(&tb->wake[id].flag, bl->sense);
+            break;
+        }
+        if ( id + step < tb->nthreads )
+            spin_on_condition(&tb->arrive[id * tb->rounds + k].flag, bl->sense);
+    }
+
+    // wake the threads we beat, farthest first
+    while ( --k >= 0 )
+        if ( id + (1 << k) < tb->nthreads )
+            tb->wake[id + (1 << k)].flag = bl->sense;
+
+    bl->sense = !bl->sense;
+    __asm__ __volatile__ ("" ::: "memory");
+}
+
+static inline void tourn_barrier_destroy(tourn_barrier_t *tb)
+{
+    free(tb->arrive);
+    free(tb->wake);
+}
+
+
+/*
+ * Static combining-tree barrier (Yew, Tzeng and Lawrie).
+ * Threads are grouped CTREE_FANIN at a time under the leaves of a
+ * tree of counters with fan-in CTREE_FANIN. The last thread to 
+ * arrive at a node climbs to its parent, so every counter is only
+ * contended by CTREE_FANIN threads. The last arrival at the root 
+ * releases the tree top-down: it resets every node on its path 
+ * and flips the node's release flag, on which the other arrivals 
+ * at that node spin.
+ */
+#define CTREE_FANIN     4
+#define CTREE_MAX_DEPTH 32
+
+typedef struct {
+    //! arrivals still missing in this episode
+    unsigned int count __attribute__ ((aligned (64)));
+    unsigned int fanin;
+    int parent;
+    spin_t release __attribute__ ((aligned (64)));
+} __attribute__ ((aligned (64))) ctree_node_t;
+
+typedef struct {
+    int nthreads;
+    int nnodes;
+    //! leaves first; thread i arrives at leaf i / CTREE_FANIN
+    ctree_node_t *nodes;
+} ctree_barrier_t;
+
+static inline void ctree_barrier_init(ctree_barrier_t *cb, int nthreads)
+{
+    int level_first = 0, level_size, i;
+
+    cb->nthreads = nthreads;
+    cb->nodes = (ctree_node_t*)cacheline_alloc(
+                    (size_t)(nthreads + 1) * sizeof(ctree_node_t));
+
+    // leaves
+    level_size = (nthreads + CTREE_FANIN - 1) / CTREE_FANIN;
+    for ( i = 0; i < level_size; i++ ) {
+        cb->nodes[i].fanin = nthreads - i * CTREE_FANIN < CTREE_FANIN ?
+                             nthreads - i * CTREE_FANIN : CTREE_FANIN;
+        cb->nodes[i].parent = -1;
+    }
+    cb->nnodes = level_size;
+
+    // inner levels, until a single root
+    while ( level_size > 1 ) {
+        int parents = (level_size + CTREE_FANIN - 1) / CTREE_FANIN;
+
+        for ( i = 0; i < parents; i++ ) {
+            ctree_node_t *n = &cb->nodes[cb->nnodes + i];
+            n->fanin = level_size - i * CTREE_FANIN < CTREE_FANIN ?
+                       level_size - i * CTREE_FANIN : CTREE_FANIN;
+            n->parent = -1;
+        }
+        for ( i = 0; i < level_size; i++ )
+            cb->nodes[level_first + i].parent = cb->nnodes + i / CTREE_FANIN;
+        level_first = cb->nnodes;
+        cb->nnodes += parents;
+        level_size = parents;
+    }
+
+    for ( i = 0; i < cb->nnodes; i++ ) {
+        cb->nodes[i].count = cb->nodes[i].fanin;
+        cb->nodes[i].release = 0;
+    }
+}
+
+/*
+ * Arrival at a tree of ctree_node_t, starting from node _n_; shared
+ * by all combining-tree barriers
+ */
+static inline void ctree_arrive(ctree_node_t *nodes, int n, barrier_local_t *bl)
+{
+    int path[CTREE_MAX_DEPTH], depth = 0;
+
+    __asm__ __volatile__ ("" ::: "memory");
+    for (;;) {
+        path[depth++] = n;
+        if ( !atomic_dec_and_test(&nodes[n].count) ) {
+            spin_on_condition(&nodes[n].release, bl->sense);
+            depth--;
+            break;
+        }
+        if ( nodes[n].parent < 0 )
+            break;
+        n = nodes[n].parent;
+    }
+
+    // we were last at path[0 .. depth-1]: reset and release them
+    while ( --depth >= 0 ) {
+        n = path[depth];
+        nodes[n].count = nodes[n].fanin;
+        __asm__ __volatile__ ("" ::: "memory");
+        nodes[n].release = bl->sense;
+    }
+
+    bl->sense = !bl->sense;
+    __asm__ __volatile__ ("" ::: "memory");
+}
+
+static inline void ctree_barrier(ctree_barrier_t *cb, barrier_local_t *bl)
+{
+    ctree_arrive(cb->nodes, bl->id / CTREE_FANIN, bl);
+}
+
+static inline void ctree_barrier_destroy(ctree_barrier_t *cb)
+{
+    free(cb->nodes);
+}
+
+
+/*
+ * Hierarchical (topology-aware) combining-tree barrier.
+ * The tree follows the machine: threads first gather at the node 
+ * of their core (SMT siblings), the last of them moves on to the 
+ * node of its package, and the last of each package to the root.
+ * Release runs in reverse, root first. So each node counter and 
+ * release flag is only shared within one core, one package, or 
+ * among one representative per package, and only the root level
+ * crosses packages. Levels with a single participant are skipped.
+ *
+ * _package_[i] and _core_[i] give where thread i runs (e.g. from 
+ * the processor map of the benchmarks); core ids only need to be 
+ * unique within their package.
+ */
+typedef struct {
+    int nthreads;
+    int nnodes;
+    //! core nodes, then package nodes, then the root
+    ctree_node_t *nodes;
+    //! node where thread i arrives
+    int *leaf;
+} hier_barrier_t;
+
+static inline void hier_barrier_init(hier_barrier_t *hb, int nthreads,
+                                     const int *package, const int *core)
+{
+    int *core_of, *pkg_of, ncores = 0, npkgs = 0, root, i, j, n, p;
+
+    hb->nthreads = nthreads;
+    hb->nodes = (ctree_node_t*)cacheline_alloc(
+                    (size_t)(2 * nthreads + 1) * sizeof(ctree_node_t));
+    hb->leaf = (int*)malloc(nthreads * sizeof(int));
+    core_of = (int*)malloc(2 * nthreads * sizeof(int));
+    if ( !hb->leaf || !core_of )
+        abort();
+    pkg_of = core_of + nthreads;
+
+    // core node of every thread, and package of every core node
+    for ( i = 0; i < nthreads; i++ ) {
+        for ( j = 0; j < i; j++ )
+            if ( package[j] == package[i] && core[j] == core[i] )
+                break;
+        core_of[i] = j < i ? core_of[j] : ncores++;
+        if ( j == i ) {
+            for ( j = 0; j < i; j++ )
+                if ( package[j] == package[i] )
+                    break;
+            pkg_of[core_of[i]] = j < i ? pkg_of[core_of[j]] : npkgs++;
+        }
+    }
+    root = ncores + npkgs;
+    hb->nnodes = root + 1;
+
+    for ( n = 0; n < hb->nnodes; n++ ) {
+        hb->nodes[n].fanin = 0;
+        hb->nodes[n].parent = -1;
+    }
+    for ( i = 0; i < nthreads; i++ )
+        hb->nodes[core_of[i]].fanin++;
+    for ( n = 0; n < ncores; n++ ) {
+        hb->nodes[n].parent = ncores + pkg_of[n];
+        hb->nodes[ncores + pkg_of[n]].fanin++;
+    }
+    for ( n = ncores; n < root; n++ ) {
+        hb->nodes[n].parent = root;
+        hb->nodes[root].fanin++;
+    }
+
+    // bypass single-child nodes (parents come after their children)
+    for ( n = 0; n < hb->nnodes; n++ ) {
+        p = hb->nodes[n].parent;
+        while ( p >= 0 && hb->nodes[p].fanin == 1 )
+            p = hb->nodes[p].parent;
+        hb->nodes[n].parent = p;
+    }
+    for ( i = 0; i < nthreads; i++ ) {
+        n = core_of[i];
+        hb->leaf[i] = hb->nodes[n].fanin == 1 && hb->nodes[n].parent >= 0 ?
+                      hb->nodes[n].parent : n;
+    }
+
+    for ( n = 0; n < hb->nnodes; n++ ) {
+        hb->nodes[n].count = hb->nodes[n].fanin;
+        hb->nodes[n].release = 0;
+    }
+    free(core_of);
+}
+
+static inline void hier_barrier(hier_barrier_t *hb, barrier_local_t *bl)
+{
+    ctree_arrive(hb->nodes, hb->leaf[bl->id], bl);
+}
+
+static inline void hier_barrier_destroy(hier_barrier_t *hb)
+{
+    free(hb->nodes);
+    free(hb->leaf);
+}
+
+
+/*
+ * Spin-then-sleep sense-reversing barrier.
+ * A waiter spins on the release flag for an adaptive budget and 
+ * then sleeps on it with FUTEX_WAIT; the last arrival flips the 
+ * flag and, if anyone announced that it may sleep, wakes them all
+ * with a single FUTEX_WAKE. Balanced episodes thus never enter the
+ * kernel, while long waits give up the cpu (and let it idle) 
+ * instead of burning it.
+ * The budget is twice the running average of the spins that 
+ * preceded a release (plus a small constant), capped at 
+ * FUTEX_BARRIER_MAX_SPINS; the average decays whenever spinning
+ * ended in sleep anyway. It is kept per thread in barrier_local_t,
+ * so waiters do not write any shared line.
+ */
+#define FUTEX_BARRIER_MAX_SPINS 4000
+
+typedef struct {
+    unsigned int count __attribute__ ((aligned (64)));
+    int nthreads;
+    //! release flag, also the futex word
+    spin_t sense __attribute__ ((aligned (64)));
+    //! waiters that may be sleeping in this episode
+    unsigned int sleepers;
+} futex_barrier_t;
+
+static inline long synch_futex(volatile unsigned int *uaddr, int op,
+                               unsigned int val)
+{
+    return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+static inline void futex_barrier_init(futex_barrier_t *fb, int nthreads)
+{
+    fb->count = 0;
+    fb->nthreads = nthreads;
+    fb->sense = 0;
+    fb->sleepers = 0;
+}
+
+static inline void futex_barrier(futex_barrier_t *fb, barrier_local_t *bl)
+{
+    unsigned int sense = bl->sense;
+    int cnt, max_spins;
+
+    bl->sense = !bl->sense;
+    __asm__ __volatile__ ("" ::: "memory");
+
+    if ( atomic_inc_return(&fb->count) == fb->nthreads ) {
+        fb->count = 0;
+        // xchg orders the release before reading _sleepers_: a waiter
+        // that registered later finds the flag already flipped
+        atomic_xchg((unsigned int*)&fb->sense, sense);
+        if ( atomic_xchg(&fb->sleepers, 0) )
+            synch_futex(&fb->sense, FUTEX_WAKE_PRIVATE, INT_MAX);
+        return;
+    }
+
+    max_spins = 2 * bl->spins + 10;
+    if ( max_spins > FUTEX_BARRIER_MAX_SPINS )
+        max_spins = FUTEX_BARRIER_MAX_SPINS;
+
+    for ( cnt = 0; cnt < max_spins; cnt++ ) {
+        if ( fb->sense == sense )
+            break;
+        __asm__ __volatile__ ("pause" ::: "memory");
+    }
+    if ( cnt < max_spins ) {
+        bl->spins += (cnt - bl->spins) / 8;
+        return;
+    }
+    bl->spins -= bl->spins / 8;
+
+    atomic_inc_return(&fb->sleepers);
+    while ( fb->sense != sense )
+        synch_futex(&fb->sense, FUTEX_WAIT_PRIVATE, !sense);
+    __asm__ __volatile__ ("" ::: "memory");
+}
+
+
+/****************************** SCALABLE COUNTERS *******************************/
+/*
+ * Sharded counter: one cache line per shard (e.g. per cpu), so 
+ * that updates from different shards never contend. Reads sum all
+ * shards; they are cheap but not atomic with respect to concurrent 
+ * updates, i.e. approximate while the counter is being updated.
+ * Callers pass the shard they update (e.g. the cpu they run on).
+ * Updates keep the lock prefix, which costs little on a line that
+ * stays in the local cache, but keeps the counter exact when 
+ * threads share a shard or migrate.
+ */
+typedef struct {
+    unsigned long val;
+} __attribute__ ((aligned (64))) counter_shard_t;
+
+typedef struct {
+    int nshards;
+    counter_shard_t *shards;
+} sharded_counter_t;
+
+static inline void sharded_counter_init(sharded_counter_t *sc, int nshards)
+{
+    int i;
+
+    sc->nshards = nshards;
+    sc->shards = (counter_shard_t*)cacheline_alloc(nshards * sizeof(counter_shard_t));
+    for ( i = 0; i < nshards; i++ )
+        sc->shards[i].val = 0;
+}
+
+static inline void sharded_counter_add(sharded_counter_t *sc, int shard, long val)
+{
+    atomic_xadd64(&sc->shards[shard].val, val);
+}
+
+static inline unsigned long sharded_counter_read(sharded_counter_t *sc)
+{
+    unsigned long sum = 0;
+    int i;
+
+    for ( i = 0; i < sc->nshards; i++ )
+        sum += *(volatile unsigned long*)&sc->shards[i].val;
+    return sum;
+}
+
+static inline void sharded_counter_destroy(sharded_counter_t *sc)
+{
+    free(sc->shards);
+}
+
+
+/*
+ * SNZI, scalable non-zero indicator (Ellen, Lev, Luchangco and Moir,
+ * PODC 2007): tells whether a "surplus" (arrivals minus departures)
+ * is non-zero, without a central counter. Arrivals and departures
+ * go to a leaf of a tree; a node only passes an arrival on to its 
+ * parent when its own surplus becomes non-zero, and a departure 
+ * when it drops back to zero. So while a subtree stays busy its 
+ * operations never reach the root, and queries read a single 
+ * indicator word that only changes when the total surplus goes
+ * from/to zero.
+ *
+ * Inner nodes keep <count, version> in one word, count in halves: 
+ * the transient 1/2 state marks a node whose first arrival is still
+ * being passed on to the parent. The root keeps <count, announce, 
+ * version>; the indicator carries a version in its upper bits, so
+ * that a CAS on it acts as the SC of the paper's LL/SC.
+ *
+ * example:
+ *  snzi_t s;
+ *  snzi_init(&s, nleaves);
+ *  ...
+ *  snzi_arrive(&s, leaf);      //e.g. leaf = cpu % nleaves
+ *  ...
+ *  snzi_depart(&s, leaf);      //same leaf as the matching arrival
+ *  ...
+ *  if ( snzi_query(&s) ) ...
+ */
+#define SNZI_ARITY      4
+
+// inner node word: count (in halves) in the low half, version in the high
+#define SNZI_C(x)       ((unsigned int)(x))
+#define SNZI_V(x)       ((x) >> 32)
+#define SNZI_X(c, v)    (((unsigned long)(v) << 32) | (unsigned int)(c))
+
+// root word: count in bits 0-30, announce bit 31, version in the high half
+#define SNZI_ROOT_C(x)      ((unsigned int)(x) & 0x7fffffffU)
+#define SNZI_ROOT_A(x)      (((x) >> 31) & 1)
+#define SNZI_ROOT_X(c, a, v) (((unsigned long)(v) << 32) | \
+                              ((unsigned long)(a) << 31) | (c))
+
+typedef struct {
+    unsigned long x;
+} __attribute__ ((aligned (64))) snzi_node_t;
+
+typedef struct {
+    //! node 0 is the root; the children of node n are nK+1 .. nK+K
+    snzi_node_t *nodes;
+    int nnodes;
+    int first_leaf;
+    //! indicator (bit 0) and its version (upper bits)
+    unsigned long indicator __attribute__ ((aligned (64)));
+} snzi_t;
+
+static inline void snzi_init(snzi_t *s, int nleaves)
+{
+    int level = 1, i;
+
+    s->first_leaf = 0;
+    s->nnodes = 1;
+    while ( level < nleaves ) {
+        s->first_leaf = s->nnodes;
+        level *= SNZI_ARITY;
+        s->nnodes += level;
+    }
+    s->nodes = (snzi_node_t*)cacheline_alloc(s->nnodes * sizeof(snzi_node_t));
+    for ( i = 0; i < s->nnodes; i++ )
+        s->nodes[i].x = 0;
+    s->indicator = 0;
+}
+
+static inline void snzi_root_arrive(snzi_t *s)
+{
+    unsigned long x, nx, i;
+    volatile unsigned long *X = &s->nodes[0].x;
+
+    do {
+        x = *X;
+        if ( SNZI_ROOT_C(x) == 0 )
+            nx = SNZI_ROOT_X(1, 1, SNZI_V(x) + 1);
+        else
+            nx = SNZI_ROOT_X(SNZI_ROOT_C(x) + 1, SNZI_ROOT_A(x), SNZI_V(x));
+    } while ( atomic_cmpxchg64(&s->nodes[0].x, x, nx) != x );
+
+    if ( SNZI_ROOT_A(nx) ) {
+        // write 1 to the indicator, bumping its version
+        do {
+            i = s->indicator;
+        } while ( atomic_cmpxchg64(&s->indicator, i, (i | 1) + 2) != i );
+        atomic_cmpxchg64(&s->nodes[0].x, nx, 
+                         SNZI_ROOT_X(SNZI_ROOT_C(nx), 0, SNZI_V(nx)));
+    }
+}
+
+static inline void snzi_root_depart(snzi_t *s)
+{
+    unsigned long x, i;
+    volatile unsigned long *X = &s->nodes[0].x;
+
+    do {
+        x = *X;
+    } while ( atomic_cmpxchg64(&s->nodes[0].x, x, 
+                  SNZI_ROOT_X(SNZI_ROOT_C(x) - 1, 0, SNZI_V(x))) != x );
+    if ( SNZI_ROOT_C(x) > 1 )
+        return;
+
+    // last departure: clear the indicator, unless a new arrival
+    // (new root version) has set it meanwhile
+    for (;;) {
+        i = *(volatile unsigned long*)&s->indicator;
+        if ( SNZI_V(*X) != SNZI_V(x) )
+            return;
+        if ( atomic_cmpxchg64(&s->indicator, i, (i | 1) + 1) == i )
+            return;
+    }
+}
+
+static inline void snzi_node_arrive(snzi_t *s, int n);
+static inline void snzi_node_depart(snzi_t *s, int n);
+
+static inline void snzi_parent_arrive(snzi_t *s, int n)
+{
+    if ( n == 0 )
+        snzi_root_arrive(s);
+    else
+        snzi_node_arrive(s, n);
+}
+
+static inline void snzi_parent_depart(snzi_t *s, int n)
+{
+    if ( n == 0 )
+        snzi_root_depart(s);
+    else
+        snzi_node_depart(s, n);
+}
+
+static inline void snzi_node_arrive(snzi_t *s, int n)
+{
+    volatile unsigned long *X = &s->nodes[n].x;
+    int parent = (n - 1) / SNZI_ARITY, succ = 0, undo = 0;
+    unsigned long x;
+
+    while ( !succ ) {
+        x = *X;
+        if ( SNZI_C(x) >= 2 ) {
+            if ( atomic_cmpxchg64(&s->nodes[n].x, x, 
+                                  SNZI_X(SNZI_C(x) + 2, SNZI_V(x))) == x )
+                succ = 1;
+        } else if ( SNZI_C(x) == 0 ) {
+            if ( atomic_cmpxchg64(&s->nodes[n].x, x, 
+                                  SNZI_X(1, SNZI_V(x) + 1)) == x ) {
+                succ = 1;
+                x = SNZI_X(1, SNZI_V(x) + 1);
+            }
+        }
+        if ( SNZI_C(x) == 1 ) {
+            // help the first arrival: pass it on, then complete 1/2 -> 1
+            snzi_parent_arrive(s, parent);
+            if ( atomic_cmpxchg64(&s->nodes[n].x, x, 
+                                  SNZI_X(2, SNZI_V(x))) != x )
+                undo++;
+        }
+    }
+    while ( undo-- > 0 )
+        snzi_parent_depart(s, parent);
+}
+
+static inline void snzi_node_depart(snzi_t *s, int n)
+{
+    volatile unsigned long *X = &s->nodes[n].x;
+    unsigned long x;
+
+    for (;;) {
+        x = *X;
+        if ( atomic_cmpxchg64(&s->nodes[n].x, x, 
+                              SNZI_X(SNZI_C(x) - 2, SNZI_V(x))) == x ) {
+            if ( SNZI_C(x) == 2 )
+                snzi_parent_depart(s, (n - 1) / SNZI_ARITY);
+            return;
+        }
+    }
+}
+
+static inline void snzi_arrive(snzi_t *s, int leaf)
+{
+    snzi_parent_arrive(s, s->first_leaf + leaf);
+}
+
+static inline void snzi_depart(snzi_t *s, int leaf)
+{
+    snzi_parent_depart(s, s->first_leaf + leaf);
+}
+
+static inline int snzi_query(snzi_t *s)
+{
+    return *(volatile unsigned long*)&s->indicator & 1;
+}
+
+static inline void snzi_destroy(snzi_t *s)
+{
+    free(s->nodes);
+}
+
 #endif
@@ -18,8 +18,8 @@ void ff_init(ff_queue_t *q, int size)
 {
     int i;
 
-    q->buffer = (unsigned long*)malloc(sizeof(unsigned long)*size);
-    if ( !q->buffer ) {
+    // cache-line aligned, so that batches of 8 aligned slots fill whole lines
+    if ( posix_memalign((void**)&q->buffer, 64, sizeof(unsigned long)*size) ) {
         fprintf(stderr, "%s: Allocation error\n", __FUNCTION__);
         exit(EXIT_FAILURE);
     }
@@ -71,6 +71,108 @@ inline int ff_dequeue(ff_queue_t *q, void **data)
     return 0;
 }
 
+/**
+ * Enqueues a batch of elements, either all of them or none
+ * @param q queue handler
+ * @param items addresses of data to be enqueued
+ * @param n number of elements, at most the queue size
+ * @return 0 if successful, FF_WOULDBLOCK if the batch does not fit
+ */ 
+int ff_enqueue_bulk(ff_queue_t *q, void **items, unsigned int n)
+{
+    volatile unsigned long *buffer = q->buffer;
+    unsigned int head = q->head, last, first, i;
+
+    if ( n == 0 )
+        return 0;
+    if ( n > q->size )
+        return FF_WOULDBLOCK;
+
+    // The consumer empties slots in order, so if the last slot of
+    // the batch is empty, all slots before it are empty too
+    last = head + n - 1;
+    if ( last >= q->size ) last -= q->size;
+    if ( buffer[last] != 0 )
+        return FF_WOULDBLOCK;
+
+    // Fill slots in order (the consumer relies on it, see
+    // ff_dequeue_bulk), as at most two contiguous runs
+    first = q->size - head;
+    if ( first > n ) first = n;
+    for ( i = 0; i < first; i++ )
+        buffer[head + i] = (unsigned long)items[i];
+    for ( ; i < n; i++ )
+        buffer[i - first] = (unsigned long)items[i];
+
+    head += n;
+    if ( head >= q->size ) head -= q->size;
+    q->head = head;
+
+    return 0;
+}
+
+/**
+ * Dequeues up to _max_ elements
+ * @param q queue handler
+ * @param out placeholders for dequeued data
+ * @param max maximum number of elements to dequeue
+ * @return number of elements dequeued, 0 if queue is empty
+ */ 
+int ff_dequeue_bulk(ff_queue_t *q, void **out, unsigned int max)
+{
+    volatile unsigned long *buffer = q->buffer;
+    unsigned int tail = q->tail, n, slot, first, i;
+
+    if ( max > q->size ) max = q->size;
+    if ( max == 0 )
+        return 0;
+
+    // The producer fills slots in order, so if the last slot of
+    // the batch is full, all slots before it are full too;
+    // otherwise take the full slots up to the first empty one
+    slot = tail + max - 1;
+    if ( slot >= q->size ) slot -= q->size;
+    if ( buffer[slot] != 0 ) {
+        n = max;
+    } else {
+        for ( n = 0, slot = tail; n < max - 1 && buffer[slot] != 0; n++ ) {
+            slot++;
+            if ( slot == q->size ) slot = 0;
+        }
+        if ( n == 0 )
+            return 0;
+    }
+
+    // Empty slots in order (the producer relies on it), as at most
+    // two contiguous runs
+    first = q->size - tail;
+    if ( first > n ) first = n;
+    for ( i = 0; i < first; i++ ) {
+        out[i] = (void*)buffer[tail + i];
+        buffer[tail + i] = 0;
+    }
+    for ( ; i < n; i++ ) {
+        out[i] = (void*)buffer[i - first];
+        buffer[i - first] = 0;
+    }
+
+    tail += n;
+    if ( tail >= q->size ) tail -= q->size;
+    q->tail = tail;
+
+    return n;
+}
+
+/**
+ * Frees queue buffer
+ * @param q queue handler
+ */ 
+void ff_destroy(ff_queue_t *q)
+{
+    free(q->buffer);
+    q->buffer = NULL;
+}
+
 /**
  * Prints queue contents
  * @param q queue handler
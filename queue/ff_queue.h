@@ -29,6 +29,8 @@ typedef struct ff_queue_st {
 extern void ff_init(ff_queue_t *q, int size);
 extern int ff_enqueue(ff_queue_t *q, void *data);
 extern int ff_dequeue(ff_queue_t *q, void **data);
+extern int ff_enqueue_bulk(ff_queue_t *q, void **items, unsigned int n);
+extern int ff_dequeue_bulk(ff_queue_t *q, void **out, unsigned int max);
 extern void ff_destroy(ff_queue_t *q);
 extern void ff_print(ff_queue_t *q);
 
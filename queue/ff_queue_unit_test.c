@@ -6,7 +6,8 @@ int main(int argc, char **argv)
 {
     char input[10] = "abcdefghij";
     char* out;
-    int ret, next = 0;
+    void *items[4];
+    int i, ret, next = 0;
 
     ff_queue_t q;
     ff_init(&q, 5);
@@ -38,5 +39,41 @@ int main(int argc, char **argv)
     } 
     ff_print(&q);
 
+    // batches of 3 in, 2 out: enqueues and dequeues wrap around
+    for ( next = 0; next < 3; next++ ) {
+        fprintf(stderr, "\nEnqueing batch %.3s...", &input[3 * next]);
+        for ( i = 0; i < 3; i++ )
+            items[i] = &input[3 * next + i];
+        ret = ff_enqueue_bulk(&q, items, 3);
+        if ( ret == FF_WOULDBLOCK )
+            fprintf(stderr, "Queue is full\n");
+        else
+            fprintf(stderr, "OK\n");
+        ff_print(&q);
+
+        fprintf(stderr, "\nDequeing up to 2...");
+        ret = ff_dequeue_bulk(&q, items, 2);
+        fprintf(stderr, "OK, vals=");
+        for ( i = 0; i < ret; i++ )
+            fprintf(stderr, "%c", *(char*)items[i]);
+        fprintf(stderr, "\n");
+        ff_print(&q);
+    }
+
+    for (;;) {
+        fprintf(stderr, "\nDequeing up to 4...");
+        ret = ff_dequeue_bulk(&q, items, 4);
+        if ( ret == 0 ) {
+            fprintf(stderr, "Queue is empty\n");
+            break;
+        }
+        fprintf(stderr, "OK, vals=");
+        for ( i = 0; i < ret; i++ )
+            fprintf(stderr, "%c", *(char*)items[i]);
+        fprintf(stderr, "\n");
+        ff_print(&q);
+    }
+    ff_print(&q);
+
     return 0;
 }
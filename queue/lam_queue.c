@@ -69,6 +69,16 @@ inline int lam_dequeue(lam_queue_t *q, void **data)
     return 0;
 }
 
+/**
+ * Frees queue buffer
+ * @param q queue handler
+ */ 
+void lam_destroy(lam_queue_t *q)
+{
+    free(q->buffer);
+    q->buffer = NULL;
+}
+
 /**
  * Prints queue contents
  * @param q queue handler
@@ -9,17 +9,22 @@
 #define _GNU_SOURCE
 
 #include <assert.h>
+#include <limits.h>
 #include <pthread.h>
 #include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include "ff_queue.h"
 #include "lam_queue.h"
 #include "util/tsc_x86_64.h"
 #include "util/processor_map.h"
 #include "util/util.h"
+#include "bench/stats.h"
+#include "bench/placement.h"
+#include "bench/perf_counters.h"
 
 pthread_barrier_t bar;
 tsctimer_t tim;
@@ -33,6 +38,19 @@ int queue_size;
 // number of iterations (dequeue / spin / enqueue)
 unsigned long niters;
 
+// time-bounded mode: run each pipeline for _duration_ms_ instead
+// of a fixed number of iterations
+unsigned long duration_ms = 0;
+volatile int stop __attribute__ ((aligned (64)));
+
+// measured runs per queue, and discarded warm-up runs before them
+int reps = 1;
+int warmups = 0;
+
+// items moved per ff_dequeue_bulk / ff_enqueue_bulk call of the
+// stage_ff_bulk pipeline (-b), 0 to skip it
+int batch = 0;
+
 // local work nanoseconds
 unsigned long delay_nanosecs;
 // local work in cycles
@@ -47,6 +65,10 @@ char *data;
 
 typedef struct {
     int id;
+    //! completed iterations
+    unsigned long iters;
+    //! hardware counters of the timed region (-e)
+    perf_counters_t perf;
 } targs_t;
 
 void* stage_ff(void *args)
@@ -58,18 +80,60 @@ void* stage_ff(void *args)
 
     in_q = ta->id;
     out_q = (ta->id + 1 < nstages ? ta->id + 1 : 0 );
+    perf_counters_open(&ta->perf);
 
     pthread_barrier_wait(&bar);
     if ( ta->id == 0 ) timer_start(&tim);
+    perf_counters_start(&ta->perf);
 
-    while ( i++ < niters ) {
-        while ( (ret = ff_dequeue(&ffq[in_q], (void*)&item)) ) ;
+    while ( i < niters && !stop ) {
+        while ( (ret = ff_dequeue(&ffq[in_q], (void*)&item)) && !stop ) ;
+        if ( ret ) break;
         spin_for_cycles(delay_cycles);
-        while ( (ret = ff_enqueue(&ffq[out_q], (void*)&item)) ) ;
+        while ( (ret = ff_enqueue(&ffq[out_q], (void*)&item)) && !stop ) ;
+        if ( ret ) break;
+        i++;
+    }
+    ta->iters = i;
+    perf_counters_stop(&ta->perf);
+
+    pthread_barrier_wait(&bar);
+    if ( ta->id == 0 ) timer_stop(&tim);
+    perf_counters_close(&ta->perf);
+    
+    pthread_exit(NULL);
+}
+
+void* stage_ff_bulk(void *args)
+{
+    unsigned long i = 0, max;
+    int ret, n, in_q, out_q;
+    char* items[batch];
+    targs_t *ta = (targs_t*)args;
+
+    in_q = ta->id;
+    out_q = (ta->id + 1 < nstages ? ta->id + 1 : 0 );
+    perf_counters_open(&ta->perf);
+
+    pthread_barrier_wait(&bar);
+    if ( ta->id == 0 ) timer_start(&tim);
+    perf_counters_start(&ta->perf);
+
+    while ( i < niters && !stop ) {
+        max = niters - i < batch ? niters - i : batch;
+        while ( !(n = ff_dequeue_bulk(&ffq[in_q], (void**)items, max)) && !stop ) ;
+        if ( !n ) break;
+        spin_for_cycles(n * delay_cycles);
+        while ( (ret = ff_enqueue_bulk(&ffq[out_q], (void**)items, n)) && !stop ) ;
+        if ( ret ) break;
+        i += n;
     }
+    ta->iters = i;
+    perf_counters_stop(&ta->perf);
 
     pthread_barrier_wait(&bar);
     if ( ta->id == 0 ) timer_stop(&tim);
+    perf_counters_close(&ta->perf);
     
     pthread_exit(NULL);
 }
@@ -83,18 +147,26 @@ void* stage_lam(void *args)
 
     in_q = ta->id;
     out_q = (ta->id + 1 < nstages ? ta->id + 1 : 0 );
+    perf_counters_open(&ta->perf);
 
     pthread_barrier_wait(&bar);
     if ( ta->id == 0 ) timer_start(&tim);
+    perf_counters_start(&ta->perf);
 
-    while ( i++ < niters ) {
-        while ( (ret = lam_dequeue(&lamq[in_q], (void*)&item)) ) ;
+    while ( i < niters && !stop ) {
+        while ( (ret = lam_dequeue(&lamq[in_q], (void*)&item)) && !stop ) ;
+        if ( ret ) break;
         spin_for_cycles(delay_cycles);
-        while ( (ret = lam_enqueue(&lamq[out_q], (void*)&item)) ) ;
+        while ( (ret = lam_enqueue(&lamq[out_q], (void*)&item)) && !stop ) ;
+        if ( ret ) break;
+        i++;
     }
+    ta->iters = i;
+    perf_counters_stop(&ta->perf);
 
     pthread_barrier_wait(&bar);
     if ( ta->id == 0 ) timer_stop(&tim);
+    perf_counters_close(&ta->perf);
     
     pthread_exit(NULL);
 }
@@ -108,42 +180,25 @@ typedef struct {
 
 tfunc_t impl[] = {
     INIT_FUNC(stage_ff),
-    INIT_FUNC(stage_lam)
+    INIT_FUNC(stage_lam),
+    INIT_FUNC(stage_ff_bulk)
 };
 
-int main(int argc, char **argv)
+#define NIMPL (sizeof(impl) / sizeof(impl[0]))
+
+/*
+ * (Re)initializes the queues of all stages and populates the 1st
+ * one with pointers to all characters of 'data' array. Pointers 
+ * are copied to queue entries.
+ */
+void setup_queues(int population)
 {
-    targs_t *targs;
-    pthread_t *tids;
-    pthread_attr_t *attr;
-    procmap_t *pi;
-    int p, c, t, i, f, population;
-  
-    if ( argc < 4 ) {
-        printf("Usage: ./prog <queue_size> <iters> <nanosecs_to_spin>\n");
-        exit(EXIT_FAILURE);
-    }
+    int i;
 
-    queue_size = atoi(argv[1]);
-    niters = atoi(argv[2]);
-    delay_nanosecs = atoi(argv[3]);
-    delay_cycles = (unsigned long)((double)delay_nanosecs* timer_read_hz() 
-                                  / 1000000000.0);
-    
-    // Initialize queues
-    assert (queue_size > 16);
-    population = queue_size - 16;
     for ( i = 0; i < nstages; i++ ) {
         ff_init(&ffq[i], queue_size);
         lam_init(&lamq[i], queue_size);
     }
-    
-    data = (char*)malloc_safe(population * sizeof(char));
-    
-    // The 1st queue is populated with pointers to all
-    // characters of 'data' array. Pointers are copied to
-    // queue entries.
-    for ( i = 0; i < population; i++ ) data[i] = i;
 
     for ( i = 0; i < population; i++ ) {
         int ret = ff_enqueue(&ffq[0], (void*)&data[i]);
@@ -159,63 +214,176 @@ int main(int argc, char **argv)
             exit(EXIT_FAILURE);
         }
     }
+}
+
+void teardown_queues(void)
+{
+    int i;
+
+    for ( i = 0; i < nstages; i++ ) {
+        ff_destroy(&ffq[i]);
+        lam_destroy(&lamq[i]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    targs_t *targs;
+    pthread_t *tids;
+    pthread_attr_t *attr;
+    procmap_t *pi;
+    placement_t *pl;
+    char *placement_spec = "scatter";
+    int i, f, population, opt, rep;
+    unsigned long iters_done = 0;
+    double *rates;
+    stats_t rate;
+    perf_counters_t perf;
+
+    while ( (opt = getopt(argc, argv, "b:T:R:W:P:e:")) != -1 ) {
+        switch ( opt ) {
+            case 'b':
+                batch = atoi(optarg);
+                break;
+            case 'T':
+                duration_ms = atol(optarg);
+                break;
+            case 'R':
+                reps = atoi(optarg);
+                break;
+            case 'W':
+                warmups = atoi(optarg);
+                break;
+            case 'P':
+                placement_spec = optarg;
+                break;
+            case 'e':
+                if ( perf_events_parse(optarg) )
+                    argc = 0;
+                break;
+            default:
+                argc = 0;
+        }
+    }
+  
+    if ( argc - optind < 3 || reps < 1 || warmups < 0 || batch < 0 ) {
+        printf("Usage: ./prog [-b batch] [-T millisecs] [-R reps] [-W warmups] [-P placement] "
+               "[-e events] <queue_size> <iters> <nanosecs_to_spin>\n");
+        printf("       placement: " PLACEMENT_USAGE " (default: scatter)\n");
+        printf("       events: " PERF_EVENTS_USAGE "\n");
+        printf("       with -T, iters is an upper bound (0 for none)\n");
+        printf("       with -b, stage_ff_bulk also runs, moving up to batch "
+               "items per queue operation\n");
+        exit(EXIT_FAILURE);
+    }
+
+    queue_size = atoi(argv[optind]);
+    niters = atol(argv[optind + 1]);
+    delay_nanosecs = atoi(argv[optind + 2]);
+    delay_cycles = (unsigned long)((double)delay_nanosecs* timer_read_hz() 
+                                  / 1000000000.0);
+    if ( duration_ms && niters == 0 )
+        niters = ULONG_MAX;
+    
+    assert (queue_size > 16);
+    population = queue_size - 16;
+    if ( batch > population ) {
+        fprintf(stderr, "Batch larger than the pipeline population. Exiting\n");
+        exit(EXIT_FAILURE);
+    }
+    data = (char*)malloc_safe(population * sizeof(char));
+    for ( i = 0; i < population; i++ ) data[i] = i;
 
-    // Configure thread affinity: first fill cores, then packages, 
-    // and last peer threads
+    // Configure thread affinity according to the placement policy
+    // (by default, alternate packages, then fill cores, and last 
+    // peer threads). Stage i runs on the i-th cpu of the placement.
     pi = procmap_init();
-    cpu_set_t cpusets[pi->num_cpus];
-
-    i = 0;
-    fprintf(stdout, "Thread mapping:\n");
-    for ( t = 0; t < pi->num_threads_per_core; t++ ) {
-        for ( c = 0; c < pi->num_cores_per_package; c++ ) {
-            for ( p = 0; p < pi->num_packages; p++ ) {
-                int cpu_id = pi->package[p].core[c].thread[t]->cpu_id;
-                CPU_ZERO(&cpusets[i]);
-                CPU_SET(cpu_id, &cpusets[i]);
-
-                fprintf(stdout, "Thread %d @ package %d, core %d, "
-                                "hw thread %d (cpuid: %d)\n",
-                                i, p, c, t, cpu_id);
-                i++;
-            }
-        }    
+    pl = placement_init(pi, placement_spec);
+    if ( !pl ) {
+        fprintf(stderr, "Invalid placement: %s\n", placement_spec);
+        exit(EXIT_FAILURE);
     }
-    fprintf(stdout, "\n");
+    cpu_set_t cpusets[nstages];
+
+    for ( i = 0; i < nstages; i++ ) {
+        CPU_ZERO(&cpusets[i]);
+        CPU_SET(pl->slots[i % pl->nslots].cpu_id, &cpusets[i]);
+    }
+    placement_print(pl, stdout);
+    perf_events_check(stderr);
 
     // Allocate thread structures 
     tids = (pthread_t*)malloc_safe( nstages * sizeof(pthread_t) );
     targs = (targs_t*)malloc_safe( nstages * sizeof(targs_t)); 
     attr = (pthread_attr_t*)malloc_safe( nstages * sizeof(pthread_attr_t)); 
+    rates = (double*)malloc_safe( reps * sizeof(double));
     pthread_barrier_init(&bar, NULL, nstages);
 
-    for ( f = 0; f < 2; f++ ) {
-        timer_clear(&tim);
-
-        // Create threads
-        for ( i = 0; i < nstages; i++ ) {
-            targs[i].id = i;
-            pthread_attr_init(&attr[i]);
-            pthread_attr_setaffinity_np(&attr[i], 
-                                        sizeof(cpusets[i]), 
-                                        &cpusets[i]);
-            pthread_create(&tids[i], 
-                           &attr[i], 
-                           impl[f].func, 
-                           (void*)&targs[i]);
+    for ( f = 0; f < NIMPL; f++ ) {
+        if ( impl[f].func == stage_ff_bulk && !batch )
+            continue;
+        // warm-up runs are discarded
+        for ( rep = -warmups; rep < reps; rep++ ) {
+            timer_clear(&tim);
+            setup_queues(population);
+            stop = 0;
+
+            // Create threads
+            for ( i = 0; i < nstages; i++ ) {
+                targs[i].id = i;
+                pthread_attr_init(&attr[i]);
+                pthread_attr_setaffinity_np(&attr[i], 
+                                            sizeof(cpusets[i]), 
+                                            &cpusets[i]);
+                pthread_create(&tids[i], 
+                               &attr[i], 
+                               impl[f].func, 
+                               (void*)&targs[i]);
+            }
+            if ( duration_ms ) {
+                usleep(duration_ms * 1000);
+                stop = 1;
+            }
+            for ( i = 0; i < nstages; i++ ) {
+                pthread_join(tids[i], NULL);
+                pthread_attr_destroy(&attr[i]);
+            }
+            teardown_queues();
+
+            // items that went through the 1st stage
+            iters_done = targs[0].iters;
+            if ( rep >= 0 )
+                rates[rep] = iters_done ? 
+                             iters_done * timer_read_hz() / timer_total(&tim) : 0;
         }
-        for ( i = 0; i < nstages; i++ ) {
-            pthread_join(tids[i], NULL);
-            pthread_attr_destroy(&attr[i]);
+        stats_compute(&rate, rates, reps);
+
+        // e.g. a short -T run in which stage 0 never got to run
+        if ( iters_done == 0 ) {
+            fprintf(stdout, "Queue:%s queue_size:%d iters:0 no progress in "
+                            "the last run\n", impl[f].name, queue_size);
+            continue;
         }
         
+        // per-iteration cycles refer to the last run
         fprintf(stdout, "Queue:%s queue_size:%d iters:%lu" 
                         " nsecs_to_spin:%lu cycles_to_spin:%lu" 
-                        " cycles_per_iter:%lf cycles_per_iter_wo_delay:%lf\n", 
-                        impl[f].name, queue_size, niters,
+                        " cycles_per_iter:%lf cycles_per_iter_wo_delay:%lf", 
+                        impl[f].name, queue_size, iters_done,
                         delay_nanosecs, delay_cycles,
-                        timer_total(&tim)/niters, 
-                        timer_total(&tim)/niters - delay_cycles );
+                        timer_total(&tim)/iters_done, 
+                        timer_total(&tim)/iters_done - delay_cycles );
+        if ( impl[f].func == stage_ff_bulk )
+            fprintf(stdout, " batch:%d", batch);
+        if ( reps > 1 || duration_ms )
+            fprintf(stdout, " items_per_sec:%lf stddev:%lf ci95:%lf runs:%d",
+                            rate.mean, rate.stddev, rate.ci95, reps);
+        // counts of all stages per item that went around the pipeline
+        perf_counters_clear(&perf);
+        for ( i = 0; i < nstages; i++ )
+            perf_counters_merge(&perf, &targs[i].perf);
+        perf_counters_report(stdout, &perf, iters_done);
+        fprintf(stdout, "\n");
     }
             
     // Clean-up things
@@ -223,6 +391,9 @@ int main(int argc, char **argv)
     free(tids);
     free(targs);
     free(attr);
+    free(rates);
+    free(data);
+    placement_destroy(pl);
     procmap_destroy(pi); 
 
     return 0;
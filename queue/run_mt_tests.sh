@@ -15,3 +15,12 @@ do
         ./mt_test $qs 10000000 $nanosecs | grep -i cycles_per_iter >> $outfile
     done
 done
+
+# batched enqueue / dequeue: cycles per item by batch size
+for batch in 1 4 8 16 32
+do
+    for nanosecs in 1 100 1000
+    do
+        ./mt_test -b $batch 1024 10000000 $nanosecs | grep stage_ff_bulk >> $outfile
+    done
+done